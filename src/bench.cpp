@@ -0,0 +1,215 @@
+#include "bench.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "histogram.h"
+#include "light.h"
+#include "refract.h"
+
+struct StageResult {
+	std::string lens;		//which synthetic lens, "n rays"
+	std::string stage;
+	size_t rays = 0;
+	double bytesPerRay = 0;	//what the stage reads and writes per ray, from the array layouts, parse uses the obj size
+	std::vector<double> seconds;	//one per timed run, sorted
+	double speedup = 0;		//median of the stage this one replaced over this one's, 0 when there's nothing to compare with
+
+	double Percentile(double q) const { return seconds[std::min(seconds.size() - 1, size_t(q * double(seconds.size() - 1) + 0.5))]; }
+};
+
+static uint64_t Hash(uint64_t x) {	//splitmix64, the lenses come out the same every run
+	x += 0x9E3779B97F4A7C15ull;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+	return x ^ (x >> 31);
+}
+
+static double Uniform(uint64_t i, uint64_t stream) { return double(Hash(i * 4 + stream) >> 11) / 9007199254740992.0; }	//[0, 1)
+
+//numRays vertices on a square grid over (-1, 1), a gentle bump for z, normals tilted at random with tirFraction of them past the critical angle for eta
+static void SyntheticLens(size_t numRays, double tirFraction, double eta, std::vector<Eigen::Vector3d>* vertices, std::vector<Eigen::Vector3d>* normals) {
+	size_t side = std::max<size_t>(2, size_t(std::ceil(std::sqrt(double(numRays)))));
+	double critical = std::asin(1 / eta);	//normals tilted further than this away from +z send the ray back into the glass
+	vertices->resize(numRays);
+	normals->resize(numRays);
+	for (size_t i = 0; i < numRays; i++) {
+		double x = -1 + 2.0 * double(i % side) / double(side - 1), y = -1 + 2.0 * double(i / side) / double(side - 1);
+		(*vertices)[i] = Eigen::Vector3d(x, y, 0.05 * std::sin(3 * x) * std::cos(2 * y));
+		double tilt = Uniform(i, 0) < tirFraction ? critical + (1.5 - critical) * Uniform(i, 1) : 0.9 * critical * Uniform(i, 1);
+		double azimuth = 6.283185307179586 * Uniform(i, 2);
+		(*normals)[i] = Eigen::Vector3d(std::sin(tilt) * std::cos(azimuth), std::sin(tilt) * std::sin(azimuth), std::cos(tilt));
+	}
+}
+
+//the parser the repo started with, kept verbatim apart from the names so the parse stage has something to be compared against
+static std::vector<std::string> BaselineSplit(std::string s, std::string delimiter) {
+	size_t pos_start = 0, pos_end, delim_len = delimiter.length();
+	std::string token;
+	std::vector<std::string> res;
+
+	while ((pos_end = s.find(delimiter, pos_start)) != std::string::npos) {
+		token = s.substr(pos_start, pos_end - pos_start);
+		pos_start = pos_end + delim_len;
+		res.push_back(token);
+	}
+
+	res.push_back(s.substr(pos_start));
+	return res;
+}
+
+static void BaselineParseOBJ(std::string objFilePath, std::vector<Eigen::Vector3d>* vertices, std::vector<Eigen::Vector3d>* normals) {
+	std::string line;
+	std::ifstream file(objFilePath);
+	if (file.is_open()) {
+		while (std::getline(file, line))
+		{
+			if (line.substr(0,2) == "v ") {
+				std::vector<std::string> lineContents = BaselineSplit(line, " ");
+				Eigen::Vector3d vertex(std::stod(lineContents[1]), std::stod(lineContents[2]), std::stod(lineContents[3]));
+				vertices->push_back(vertex);
+			}
+			else if (line.substr(0, 2) == "vn") {
+				std::vector<std::string> lineContents = BaselineSplit(line, " ");
+				Eigen::Vector3d normal(std::stod(lineContents[1]), std::stod(lineContents[2]), std::stod(lineContents[3]));
+				normals->push_back(normal);
+			}
+			else if (line.substr(0, 2) == "vt") { break; }
+		}
+		file.close();
+	}
+	else { std::cout << "Invalid file\n"; }
+}
+
+static bool WriteOBJ(const std::string& path, const std::vector<Eigen::Vector3d>& vertices, const std::vector<Eigen::Vector3d>& normals) {	//the same shape exporters write, all v lines then all vn lines
+	std::FILE* file = std::fopen(path.c_str(), "wb");
+	if (file == nullptr) { std::cout << "Couldn't write " << path << "\n"; return false; }
+	for (const Eigen::Vector3d& v : vertices) { std::fprintf(file, "v %.6f %.6f %.6f\n", v.x(), v.y(), v.z()); }
+	for (const Eigen::Vector3d& n : normals) { std::fprintf(file, "vn %.6f %.6f %.6f\n", n.x(), n.y(), n.z()); }
+	return std::fclose(file) == 0;
+}
+
+template <typename Run>
+static StageResult Measure(const std::string& lens, const std::string& stage, size_t rays, double bytesPerRay, int reps, Run run) {
+	StageResult result{ lens, stage, rays, bytesPerRay, {} };
+	run();	//warm up, first touch of the output pages shouldn't count
+	for (int r = 0; r < reps; r++) {
+		auto start = std::chrono::steady_clock::now();
+		run();
+		result.seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+	}
+	std::sort(result.seconds.begin(), result.seconds.end());
+	std::printf("%-12s %-15s %12.1f Mrays/s %8.1f B/ray   min %9.3f  p50 %9.3f  p90 %9.3f  p99 %9.3f ms\n", lens.c_str(), stage.c_str(), double(rays) / result.Percentile(0.5) / 1e6, bytesPerRay,
+		result.seconds.front() * 1e3, result.Percentile(0.5) * 1e3, result.Percentile(0.9) * 1e3, result.Percentile(0.99) * 1e3);
+	return result;
+}
+
+static bool WriteJSON(const std::string& path, const std::vector<StageResult>& results, int numThreads, double tirFraction) {
+	std::ofstream file(path);
+	if (!file.is_open()) { std::cout << "Couldn't write " << path << "\n"; return false; }
+	file.precision(9);
+	file << "{\n  \"threads\": " << numThreads << ",\n  \"tirFraction\": " << tirFraction << ",\n  \"results\": [\n";
+	for (size_t k = 0; k < results.size(); k++) {
+		const StageResult& r = results[k];
+		file << "    { \"lens\": \"" << r.lens << "\", \"stage\": \"" << r.stage << "\", \"rays\": " << r.rays << ", \"runs\": " << r.seconds.size()
+			<< ", \"raysPerSecond\": " << double(r.rays) / r.Percentile(0.5) << ", \"bytesPerRay\": " << r.bytesPerRay << (r.speedup > 0 ? ", \"speedup\": " + std::to_string(r.speedup) : std::string())
+			<< ", \"seconds\": { \"min\": " << r.seconds.front() << ", \"p50\": " << r.Percentile(0.5) << ", \"p90\": " << r.Percentile(0.9) << ", \"p99\": " << r.Percentile(0.99) << ", \"max\": " << r.seconds.back() << " } }"
+			<< (k + 1 < results.size() ? ",\n" : "\n");
+	}
+	file << "  ]\n}\n";
+	return bool(file);
+}
+
+int RunBenchmarks(int argc, char** argv) {
+	std::vector<size_t> sizes = { 10000, 100000, 1000000 };
+	double tirFraction = 0.05;
+	int reps = 10;
+	int numThreads = 1;
+	size_t parseLimit = 10000000;	//a 100M ray obj is around 7GB of text
+	std::string jsonPath;
+	for (int i = 0; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--sizes" && i + 1 < argc) {
+			sizes.clear();
+			std::string list = argv[++i];
+			for (size_t begin = 0; begin < list.size(); ) {
+				size_t end = std::min(list.find(',', begin), list.size());
+				if (end > begin) { sizes.push_back(std::stoull(list.substr(begin, end - begin))); }
+				begin = end + 1;
+			}
+		}
+		else if (arg == "--tir" && i + 1 < argc) { tirFraction = std::stod(argv[++i]); }
+		else if (arg == "--reps" && i + 1 < argc) { reps = std::max(1, std::stoi(argv[++i])); }
+		else if ((arg == "--threads" || arg == "-t") && i + 1 < argc) { numThreads = std::stoi(argv[++i]); }
+		else if (arg == "--parse-limit" && i + 1 < argc) { parseLimit = std::stoull(argv[++i]); }
+		else if (arg == "--json" && i + 1 < argc) { jsonPath = argv[++i]; }
+		else { std::cout << "Unknown argument " << arg << "\n"; }
+	}
+	ThreadPool pool(numThreads);
+	const double eta = glassEta, receiverPlane = 3;
+	const Light light;
+	std::vector<StageResult> results;
+
+	for (size_t numRays : sizes) {
+		if (numRays == 0) { continue; }
+		std::string lens = std::to_string(numRays) + " rays";
+		std::vector<Eigen::Vector3d> vertices, normals;
+		SyntheticLens(numRays, tirFraction, eta, &vertices, &normals);
+
+		if (numRays <= parseLimit) {	//through the file system, so a warm page cache, this is the parser not the disk
+			std::string objPath = (std::filesystem::temp_directory_path() / "caustics_bench.obj").string();
+			if (WriteOBJ(objPath, vertices, normals)) {
+				double fileBytes = double(std::filesystem::file_size(objPath));
+				std::vector<Eigen::Vector3d> parsedVertices, parsedNormals;
+				StageResult baseline = Measure(lens, "parse_baseline", numRays, fileBytes / double(numRays), reps, [&]() {	//same file, the getline/split/stod loop it replaced
+					parsedVertices.clear();
+					parsedNormals.clear();
+					BaselineParseOBJ(objPath, &parsedVertices, &parsedNormals);
+				});
+				results.push_back(baseline);
+				results.push_back(Measure(lens, "parse", numRays, fileBytes / double(numRays), reps, [&]() {
+					parsedVertices.clear();
+					parsedNormals.clear();
+					ParseOBJ(objPath, &parsedVertices, &parsedNormals, nullptr, nullptr, &pool);
+				}));
+				results.back().speedup = baseline.Percentile(0.5) / results.back().Percentile(0.5);
+				std::printf("%-12s %-15s %12.1fx the baseline parser at the median\n", lens.c_str(), "parse speedup", results.back().speedup);
+			}
+			std::filesystem::remove(objPath);
+		}
+
+		RayBuffer<double> rays;
+		FillRayBuffer(vertices, normals, &rays, &pool);
+		{	//the original array of structs path, single threaded like it always was
+			std::vector<Eigen::Vector3d> refracteds(numRays);
+			std::vector<Eigen::Vector2d> intersections(numRays);
+			results.push_back(Measure(lens, "refract_aos", numRays, 48, reps, [&]() { Refract(normals, refracteds, eta); }));
+			results.push_back(Measure(lens, "intersect_aos", numRays, 64, reps, [&]() { CalculateIntersections(vertices, refracteds, intersections, receiverPlane); }));
+		}
+		vertices = {};
+		normals = {};
+
+		IntersectionCache<double> cache;
+		RayArray<double> intersectionsX(numRays), intersectionsY(numRays);
+		results.push_back(Measure(lens, "refract_simd", numRays, 56, reps, [&]() { RefractRays<double>(&rays, eta, &pool); }));
+		results.push_back(Measure(lens, "prepare", numRays, 80, reps, [&]() { PrepareIntersections<double>(rays, std::span<const Light>(&light, 1), eta, &cache, &pool); }));
+		results.push_back(Measure(lens, "intersect", numRays, 48, reps, [&]() { IntersectRays<double>(cache, intersectionsX, intersectionsY, receiverPlane, &pool); }));
+
+		Histogram histogram;	//what DrawIntersections does on the CPU before handing the frame to SDL, at the default window size
+		histogram.Resize(256, 256);
+		std::vector<uint32_t> argb(256 * 256);
+		results.push_back(Measure(lens, "draw", numRays, 16, reps, [&]() {
+			histogram.Accumulate<double>(intersectionsX, intersectionsY, 1, 1, &pool);
+			histogram.ToneMap(argb.data(), 256, &pool);
+		}));
+	}
+
+	if (!jsonPath.empty() && !WriteJSON(jsonPath, results, pool.NumThreads(), tirFraction)) { return 1; }
+	return 0;
+}
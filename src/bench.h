@@ -0,0 +1,7 @@
+#pragma once
+
+//timings of the solve stages on synthetic lenses, run as caustics_bench [options], its own build target linked against the same core library as the viewer so it measures exactly the shipped kernels
+//--sizes 10000,1000000 rays per lens, --tir f fraction of the rays that get totally internally reflected, --reps n timed runs of every stage,
+//--threads n like the viewer, --parse-limit n largest lens that also gets written out as an obj to time ParseOBJ on next to the original getline/split/stod parser (reported as the parse speedup), --json path for machine readable results
+//per stage it reports rays/s at the median, the bytes a ray moves through memory, and latency percentiles over the runs
+int RunBenchmarks(int argc, char** argv);	//argc/argv are the arguments after the program name, returns the exit code
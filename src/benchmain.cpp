@@ -0,0 +1,3 @@
+#include "bench.h"
+
+int main(int argc, char** argv) { return RunBenchmarks(argc - 1, argv + 1); }	//a program of its own so it doesn't need a window or SDL at all
@@ -0,0 +1,137 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include "Eigen/Geometry"
+
+const size_t leafSize = 4;	//small leaves, a box test is about as expensive as a triangle test
+
+void TriangleBVH::Build(const RayBuffer<double>& mesh) {
+	size_t numTriangles = mesh.triangles.size() / 3;
+	std::vector<Eigen::Vector3d> centroids(numTriangles), lower(numTriangles), upper(numTriangles);
+	for (size_t t = 0; t < numTriangles; t++) {
+		lower[t] = Eigen::Vector3d::Constant(std::numeric_limits<double>::infinity());
+		upper[t] = -lower[t];
+		for (int k = 0; k < 3; k++) {
+			uint32_t corner = mesh.triangles[3 * t + k];
+			Eigen::Vector3d p(mesh.vx[corner], mesh.vy[corner], mesh.vz[corner]);
+			lower[t] = lower[t].cwiseMin(p);
+			upper[t] = upper[t].cwiseMax(p);
+		}
+		centroids[t] = (lower[t] + upper[t]) / 2;
+	}
+
+	order.resize(numTriangles);
+	std::iota(order.begin(), order.end(), 0u);
+	nodes.clear();
+	nodes.reserve(2 * numTriangles / leafSize + 1);
+	if (numTriangles > 0) { BuildNode(0, numTriangles, centroids, lower, upper); }
+
+	corners.resize(9 * numTriangles);
+	for (size_t k = 0; k < numTriangles; k++) {
+		for (int c = 0; c < 3; c++) {
+			uint32_t corner = mesh.triangles[3 * size_t(order[k]) + c];
+			corners[9 * k + 3 * c] = mesh.vx[corner]; corners[9 * k + 3 * c + 1] = mesh.vy[corner]; corners[9 * k + 3 * c + 2] = mesh.vz[corner];
+		}
+	}
+}
+
+uint32_t TriangleBVH::BuildNode(size_t begin, size_t end, const std::vector<Eigen::Vector3d>& centroids, const std::vector<Eigen::Vector3d>& lower, const std::vector<Eigen::Vector3d>& upper) {	//median split along the longest axis of the centroids, lens surfaces are close to regular grids, where that does about as well as SAH
+	Eigen::Vector3d boxLower = lower[order[begin]], boxUpper = upper[order[begin]];
+	Eigen::Vector3d centroidLower = centroids[order[begin]], centroidUpper = centroidLower;
+	for (size_t k = begin + 1; k < end; k++) {
+		boxLower = boxLower.cwiseMin(lower[order[k]]); boxUpper = boxUpper.cwiseMax(upper[order[k]]);
+		centroidLower = centroidLower.cwiseMin(centroids[order[k]]); centroidUpper = centroidUpper.cwiseMax(centroids[order[k]]);
+	}
+
+	uint32_t index = uint32_t(nodes.size());
+	Node node;
+	for (int a = 0; a < 3; a++) {	//rounded outwards so a float box never cuts off a bit of its double triangles
+		node.lower[a] = std::nextafter(float(boxLower[a]), -std::numeric_limits<float>::infinity());
+		node.upper[a] = std::nextafter(float(boxUpper[a]), std::numeric_limits<float>::infinity());
+	}
+	node.first = uint32_t(begin);
+	node.count = uint32_t(end - begin);
+	Eigen::Vector3d extent = centroidUpper - centroidLower;
+	int axis = 0;
+	extent.maxCoeff(&axis);
+	if (end - begin <= leafSize || extent[axis] <= 0) {	//few enough, or all on one spot so splitting wouldn't separate anything
+		nodes.push_back(node);
+		return index;
+	}
+
+	node.count = 0;
+	nodes.push_back(node);
+	size_t middle = begin + (end - begin) / 2;
+	std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end, [&](uint32_t a, uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+	BuildNode(begin, middle, centroids, lower, upper);
+	uint32_t second = BuildNode(middle, end, centroids, lower, upper);
+	nodes[index].first = second;	//nodes may have moved while building the children
+	return index;
+}
+
+double TriangleBVH::EnterBox(const Node& node, const Eigen::Vector3d& origin, const Eigen::Vector3d& inverseDirection, double farthest) const {
+	double enter = 0, leave = farthest;
+	for (int a = 0; a < 3; a++) {	//slab test
+		double t0 = (double(node.lower[a]) - origin[a]) * inverseDirection[a];
+		double t1 = (double(node.upper[a]) - origin[a]) * inverseDirection[a];
+		enter = std::max(enter, std::min(t0, t1));
+		leave = std::min(leave, std::max(t0, t1));
+	}
+	return enter <= leave ? enter : std::numeric_limits<double>::infinity();
+}
+
+bool TriangleBVH::Intersect(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, SurfaceHit* hit) const {
+	if (nodes.empty()) { return false; }
+	const double infinity = std::numeric_limits<double>::infinity();
+	const double epsilon = 1e-9;	//rays start on the other surface, which can touch this one, but never on this one itself
+	Eigen::Vector3d inverseDirection = direction.cwiseInverse();
+	double nearest = infinity;
+	bool found = false;
+
+	uint32_t stack[64];	//a median split is log2(n / leafSize) deep, far below this for any mesh that fits in memory
+	int top = 0;
+	uint32_t current = 0;
+	if (EnterBox(nodes[0], origin, inverseDirection, nearest) == infinity) { return false; }
+	while (true) {
+		const Node& node = nodes[current];
+		if (node.count > 0) {
+			for (size_t k = node.first; k < size_t(node.first) + node.count; k++) {	//Moller-Trumbore
+				const double* c = corners.data() + 9 * k;
+				Eigen::Vector3d a(c[0], c[1], c[2]);
+				Eigen::Vector3d edge1 = Eigen::Vector3d(c[3], c[4], c[5]) - a, edge2 = Eigen::Vector3d(c[6], c[7], c[8]) - a;
+				Eigen::Vector3d p = direction.cross(edge2);
+				double determinant = edge1.dot(p);
+				if (std::abs(determinant) < 1e-300) { continue; }	//parallel to the triangle
+				double inverse = 1 / determinant;
+				Eigen::Vector3d s = origin - a;
+				double u = s.dot(p) * inverse;
+				if (u < 0 || u > 1) { continue; }
+				Eigen::Vector3d q = s.cross(edge1);
+				double v = direction.dot(q) * inverse;
+				if (v < 0 || u + v > 1) { continue; }
+				double t = edge2.dot(q) * inverse;
+				if (t > epsilon && t < nearest) {
+					nearest = t;
+					*hit = { t, order[k], u, v };
+					found = true;
+				}
+			}
+		}
+		else {	//visit the nearer child first, the farther one is often culled by the hit found in it
+			uint32_t first = current + 1, second = node.first;
+			double enterFirst = EnterBox(nodes[first], origin, inverseDirection, nearest), enterSecond = EnterBox(nodes[second], origin, inverseDirection, nearest);
+			if (enterSecond < enterFirst) { std::swap(first, second); std::swap(enterFirst, enterSecond); }
+			if (enterFirst < infinity) {
+				if (enterSecond < infinity) { stack[top++] = second; }
+				current = first;
+				continue;
+			}
+		}
+		if (top == 0) { break; }
+		current = stack[--top];
+	}
+	return found;
+}
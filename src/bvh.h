@@ -0,0 +1,33 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "Eigen/Core"
+#include "raybuffer.h"
+
+struct SurfaceHit {
+	double t = 0;			//how far along the ray direction it hit
+	uint32_t triangle = 0;	//which triangle of the mesh, indices into mesh.triangles are 3 * triangle onwards
+	double u = 0, v = 0;	//barycentric weights of its second and third corner, the first gets 1 - u - v
+};
+
+class TriangleBVH {	//bounding volume hierarchy over the triangles of a mesh, so finding where a ray meets the surface walks O(log n) boxes instead of testing every triangle
+public:
+	void Build(const RayBuffer<double>& mesh);	//needs mesh.triangles, the corners get copied so the mesh doesn't have to stay around for Intersect
+	bool Intersect(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, SurfaceHit* hit) const;	//nearest hit in front of origin, false if the ray misses the surface
+	size_t NumTriangles() const { return order.size(); }
+
+private:
+	struct Node {	//32 bytes, two to a cache line
+		float lower[3];
+		uint32_t first;		//leaves: first entry of order they own, inner nodes: index of the second child, the first one directly follows the node
+		float upper[3];
+		uint32_t count;		//triangles in a leaf, 0 for inner nodes
+	};
+	uint32_t BuildNode(size_t begin, size_t end, const std::vector<Eigen::Vector3d>& centroids, const std::vector<Eigen::Vector3d>& lower, const std::vector<Eigen::Vector3d>& upper);
+	double EnterBox(const Node& node, const Eigen::Vector3d& origin, const Eigen::Vector3d& inverseDirection, double farthest) const;	//distance to where the ray enters the box, infinity if it misses it or only gets there past farthest
+
+	std::vector<Node> nodes;
+	std::vector<uint32_t> order;	//triangle indices sorted so every leaf owns a contiguous range
+	std::vector<double> corners;	//the three corners of order[k] at 9 * k, so the leaf tests read straight down memory
+};
@@ -0,0 +1,217 @@
+#include "design.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <span>
+#include <string>
+#include <vector>
+#include "focus.h"
+#include "heightfield.h"
+#include "histogram.h"
+#include "output.h"
+#include "png.h"
+#include "refract.h"
+#include "threadpool.h"
+
+struct DesignImage {	//what the backward pass needs from one forward pass
+	Histogram image;			//bilinearly splatted light at the target's resolution
+	std::vector<double> residual;	//dLoss/dPixel
+	double loss = 0;
+};
+
+static void SplatBilinear(std::span<const double> ix, std::span<const double> iy, Histogram* image, ThreadPool* pool) {	//every ray spreads over the four pixel centres around it, unlike the viewer's binning this moves smoothly with the ray
+	int width = image->Width(), height = image->Height();
+	double scaleX = width / 256.0, scaleY = height / 256.0;
+	image->Clear();
+	image->Splat(ix.size(), [&](size_t begin, size_t end, float* pixels) {
+		for (size_t i = begin; i < end; i++) {
+			double u = ix[i] * scaleX - 0.5, v = iy[i] * scaleY - 0.5;	//pixel centres sit on the half integers
+			if (!(u > -1 && u < width && v > -1 && v < height)) { continue; }	//off screen or lost to total internal reflection
+			int x0 = int(std::floor(u)), y0 = int(std::floor(v));
+			float fx = float(u - x0), fy = float(v - y0);
+			auto add = [&](int x, int y, float weight) { if (x >= 0 && x < width && y >= 0 && y < height) { pixels[size_t(y) * size_t(width) + size_t(x)] += weight; } };
+			add(x0, y0, (1 - fx) * (1 - fy));
+			add(x0 + 1, y0, fx * (1 - fy));
+			add(x0, y0 + 1, (1 - fx) * fy);
+			add(x0 + 1, y0 + 1, fx * fy);
+		}
+	}, pool);
+}
+
+//loss is half the squared difference between brightness * image and target, brightness maps every ray to an equal share of the target's total so a perfect lens scores 0
+static void Residual(std::span<const float> target, size_t numRays, DesignImage* design, ThreadPool* pool) {
+	std::span<const float> pixels = design->image.Pixels();
+	double total = 0;
+	for (float value : target) { total += value; }
+	double brightness = total / double(numRays);
+	design->residual.resize(pixels.size());
+	std::vector<double> partials(size_t(pool->NumThreads()), 0.0);
+	pool->ParallelChunks(pixels.size(), [&](int chunk, size_t begin, size_t end) {
+		double sum = 0;
+		for (size_t p = begin; p < end; p++) {
+			double difference = brightness * pixels[p] - target[p];
+			design->residual[p] = brightness * difference;
+			sum += difference * difference;
+		}
+		partials[size_t(chunk)] = sum;
+	});
+	design->loss = 0;
+	for (double sum : partials) { design->loss += sum / 2; }
+}
+
+//dLoss/dHeight for every height, first per ray through the splat and the refraction to the ray's own slopes and height, then gathered onto the heights through the
+//same finite differences PrepareIntersections takes the slopes with, a gather rather than a scatter so every row of heights has one thread writing it
+static void HeightGradient(const Heightfield& field, double eta, double distance, std::span<const double> ix, std::span<const double> iy, const DesignImage& design, std::span<double> gradient, ThreadPool* pool) {
+	int width = field.width, height = field.height;
+	int imageWidth = design.image.Width(), imageHeight = design.image.Height();
+	double scaleX = imageWidth / 256.0, scaleY = imageHeight / 256.0;
+	double dx = 2.0 / (width - 1), dy = 2.0 / (height - 1);
+	const double* h = field.heights.data();
+	auto at = [&](int x, int y) { return x >= 0 && x < imageWidth && y >= 0 && y < imageHeight ? design.residual[size_t(y) * size_t(imageWidth) + size_t(x)] : 0.0; };
+	auto clampX = [&](int c) { return std::clamp(c, 0, width - 1); };
+	auto clampY = [&](int r) { return std::clamp(r, 0, height - 1); };
+
+	RayArray<double> slopeGradientX(field.Size()), slopeGradientY(field.Size());	//dLoss/dgx and dLoss/dgy of every ray, where gx, gy are the height slopes it gets its normal from
+	pool->ParallelFor(size_t(height), [&](size_t begin, size_t end) {
+		for (int r = int(begin); r < int(end); r++) {
+			int up = clampY(r - 1), down = clampY(r + 1);
+			for (int c = 0; c < width; c++) {
+				size_t i = size_t(r) * size_t(width) + size_t(c);
+				slopeGradientX[i] = slopeGradientY[i] = gradient[i] = 0;
+				double u = ix[i] * scaleX - 0.5, v = iy[i] * scaleY - 0.5;
+				if (!(u > -1 && u < imageWidth && v > -1 && v < imageHeight)) { continue; }
+				int x0 = int(std::floor(u)), y0 = int(std::floor(v));
+				double fx = u - x0, fy = v - y0;
+				double r00 = at(x0, y0), r10 = at(x0 + 1, y0), r01 = at(x0, y0 + 1), r11 = at(x0 + 1, y0 + 1);
+				double lossX = ((1 - fy) * (r10 - r00) + fy * (r11 - r01)) * scaleX;	//dLoss/dix, the bilinear weights are linear in the ray's position within the cell
+				double lossY = ((1 - fx) * (r01 - r00) + fx * (r11 - r10)) * scaleY;
+
+				int left = clampX(c - 1), right = clampX(c + 1);
+				double gx = (h[size_t(r) * size_t(width) + size_t(right)] - h[size_t(r) * size_t(width) + size_t(left)]) / ((right - left) * dx);
+				double gy = (h[size_t(down) * size_t(width) + size_t(c)] - h[size_t(up) * size_t(width) + size_t(c)]) / ((down - up) * dy);
+				//the kernel's refraction with q = 1 + gx^2 + gy^2: k = eta / q - sqrt(w / q), w = 1 - eta^2 (1 - 1 / q), slopes targetScale * (gx, gy) * m with m = k / (eta - k)
+				double q = 1 + gx * gx + gy * gy, w = 1 - eta * eta * (1 - 1 / q);
+				if (w <= 0) { continue; }	//totally internally reflected, nothing to follow back
+				double rootW = std::sqrt(w), rootQ = std::sqrt(q);
+				double k = eta / q - rootW / rootQ;
+				double dk = -eta / (q * q) + eta * eta / (2 * rootW * q * q * rootQ) + rootW / (2 * q * rootQ);	//dk/dq
+				double m = k / (eta - k), dm = eta / ((eta - k) * (eta - k)) * dk;
+				double t = distance - h[i];	//ix = base + slope * (distance - height)
+				double a = targetScale * t;
+				double jacobianXX = a * (m + 2 * gx * gx * dm), jacobianXY = a * 2 * gx * gy * dm, jacobianYY = a * (m + 2 * gy * gy * dm);	//d(ix, iy)/d(gx, gy), symmetric
+				slopeGradientX[i] = lossX * jacobianXX + lossY * jacobianXY;
+				slopeGradientY[i] = lossX * jacobianXY + lossY * jacobianYY;
+				gradient[i] = -targetScale * m * (lossX * gx + lossY * gy);	//the ray also starts higher up
+			}
+		}
+	});
+	pool->ParallelFor(size_t(height), [&](size_t begin, size_t end) {
+		for (int r = int(begin); r < int(end); r++) {
+			for (int c = 0; c < width; c++) {
+				double sum = 0;
+				for (int s = std::max(c - 1, 0); s <= std::min(c + 1, width - 1); s++) {	//rays whose x difference uses this height, one sided ones at the edges included
+					int left = clampX(s - 1), right = clampX(s + 1);
+					double weight = slopeGradientX[size_t(r) * size_t(width) + size_t(s)] / ((right - left) * dx);
+					if (right == c) { sum += weight; }
+					if (left == c) { sum -= weight; }
+				}
+				for (int s = std::max(r - 1, 0); s <= std::min(r + 1, height - 1); s++) {
+					int up = clampY(s - 1), down = clampY(s + 1);
+					double weight = slopeGradientY[size_t(s) * size_t(width) + size_t(c)] / ((down - up) * dy);
+					if (down == r) { sum += weight; }
+					if (up == r) { sum -= weight; }
+				}
+				gradient[size_t(r) * size_t(width) + size_t(c)] += sum;
+			}
+		}
+	});
+}
+
+static bool WriteHeights(const Heightfield& field, const std::string& path) {	//raw float32, what ReadHeightfield takes as .f32
+	std::ofstream file(path, std::ios::binary);
+	if (!file.is_open()) { std::cout << "Couldn't write " << path << "\n"; return false; }
+	std::vector<float> heights(field.heights.begin(), field.heights.end());
+	file.write(reinterpret_cast<const char*>(heights.data()), std::streamsize(heights.size() * sizeof(float)));
+	return bool(file);
+}
+
+int RunDesign(int argc, char** argv) {
+	if (argc < 2) { std::cout << "--design needs a target image and a wall distance\n"; return 1; }
+	double distance = std::stod(argv[1]);
+	int numThreads = 0;
+	int grid = 512;	//4 rays a pixel of a 256x256 target, the bilinear splat gets noisy much below 1
+	int iterations = 500;
+	double rate = 0.025;
+	double relief = 1;
+	std::string startPath;
+	std::string prefix = "design";
+	for (int i = 2; i < argc; i++) {
+		std::string arg = argv[i];
+		if ((arg == "--threads" || arg == "-t") && i + 1 < argc) { numThreads = std::stoi(argv[++i]); }
+		else if (arg == "--grid" && i + 1 < argc) { grid = std::stoi(argv[++i]); }
+		else if (arg == "--start" && i + 1 < argc) { startPath = argv[++i]; }
+		else if (arg == "--relief" && i + 1 < argc) { relief = std::stod(argv[++i]); }
+		else if (arg == "--iterations" && i + 1 < argc) { iterations = std::stoi(argv[++i]); }
+		else if (arg == "--rate" && i + 1 < argc) { rate = std::stod(argv[++i]); }
+		else if (arg == "--output" && i + 1 < argc) { prefix = argv[++i]; }
+		else { std::cout << "Unknown argument " << arg << "\n"; }
+	}
+
+	int targetWidth = 0, targetHeight = 0;
+	std::vector<float> target;
+	if (!ReadPNG(argv[0], &targetWidth, &targetHeight, &target)) { return 1; }
+	for (float& value : target) { value = std::pow(value, 2.2f); }	//light adds up linearly, the png is gamma encoded
+
+	Heightfield field;
+	if (!startPath.empty()) {
+		if (!ReadHeightfield(startPath, relief, &field)) { return 1; }
+		if (field.width != field.height) { std::cout << startPath << " isn't square, the .f32 written at the end won't load back\n"; }
+	}
+	else {
+		if (grid < 2) { std::cout << "--grid needs at least 2 heights per side\n"; return 1; }
+		field.width = field.height = grid;
+		field.heights.assign(size_t(grid) * size_t(grid), 0.0);
+	}
+
+	ThreadPool pool(numThreads);
+	IntersectionCache<double> cache;
+	RayArray<double> intersectionsX(field.Size()), intersectionsY(field.Size());
+	RayArray<double> gradient(field.Size()), moment(field.Size(), 0.0), variance(field.Size(), 0.0);	//Adam's running mean and mean square of the gradient
+	DesignImage design;
+	design.image.Resize(targetWidth, targetHeight);
+	const double beta1 = 0.9, beta2 = 0.999, epsilon = 1e-12;
+	double spacing = 2.0 / (std::max(field.width, field.height) - 1);	//a step of rate * spacing tilts neighbouring heights by about rate, so the same rate works at any grid size
+
+	auto start = std::chrono::steady_clock::now();
+	for (int iteration = 0; iteration <= iterations; iteration++) {
+		PrepareIntersections(field, glassEta, &cache, &pool);
+		IntersectRays<double>(cache, intersectionsX, intersectionsY, distance, &pool);
+		SplatBilinear(intersectionsX, intersectionsY, &design.image, &pool);
+		Residual(target, field.Size(), &design, &pool);
+		if (iteration % 20 == 0 || iteration == iterations) { std::cout << "Iteration " << iteration << ": loss " << design.loss << ", similarity " << ImageSimilarity(design.image.Pixels(), target) << "\n"; }
+		if (iteration == iterations) { break; }	//the last pass only scores
+
+		HeightGradient(field, glassEta, distance, intersectionsX, intersectionsY, design, gradient, &pool);
+		double correction1 = 1 - std::pow(beta1, iteration + 1), correction2 = 1 - std::pow(beta2, iteration + 1);
+		double step = rate * spacing * (1 - double(iteration) / iterations);	//decays to nothing, a constant step ends up bouncing around the minimum and undoing the detail
+		pool.ParallelFor(field.Size(), [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				moment[i] = beta1 * moment[i] + (1 - beta1) * gradient[i];
+				variance[i] = beta2 * variance[i] + (1 - beta2) * gradient[i] * gradient[i];
+				field.heights[i] -= step * (moment[i] / correction1) / (std::sqrt(variance[i] / correction2) + epsilon);	//every height moves about step however steep its own gradient is
+			}
+		});
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << iterations << " iterations on " << field.width << "x" << field.height << " heights in " << seconds << "s\n";
+
+	Histogram image;	//binned like the viewer shows it, which is what the written png should look like
+	image.Resize(targetWidth, targetHeight);
+	image.Accumulate<double>(intersectionsX, intersectionsY, targetWidth / 256.0, targetHeight / 256.0, &pool);
+	if (!WriteHeights(field, prefix + ".f32") || !WriteImage(image, prefix + ".png", &pool)) { return 1; }
+	std::cout << "Wrote " << prefix << ".f32 and " << prefix << ".png, caustics " << prefix << ".f32 " << distance << " shows the lens\n";
+	return 0;
+}
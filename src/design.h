@@ -0,0 +1,8 @@
+#pragma once
+
+//inverse solve, run as caustics --design target.png distance [options], shapes a heightfield lens so its caustics on a wall at distance look like the target
+//every iteration solves the current heights with the viewer's kernels, splats the intersections bilinearly so the image is differentiable in them, and follows
+//the analytic gradient of the squared difference to the target back through the refraction to every height, then takes an Adam step on the heights
+//--grid N starts from a flat N x N lens, --start heights.png|.f32 (with --relief h) refines an existing one instead, --iterations K, --rate r how much a step may tilt the surface
+//--threads n like the viewer, --output prefix writes prefix.f32 heights the viewer can load and prefix.png of their caustics, "design" by default
+int RunDesign(int argc, char** argv);	//argc/argv are the arguments after --design, returns the exit code
@@ -0,0 +1,83 @@
+#include "exr.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+template <typename T>
+void Append(std::vector<char>* out, T value) {	//EXR is little endian throughout, like every machine this runs on
+	char bytes[sizeof(T)];
+	std::memcpy(bytes, &value, sizeof(T));
+	out->insert(out->end(), bytes, bytes + sizeof(T));
+}
+
+void AppendString(std::vector<char>* out, const char* text) { out->insert(out->end(), text, text + std::strlen(text) + 1); }
+
+void AppendAttribute(std::vector<char>* out, const char* name, const char* type, const std::vector<char>& value) {
+	AppendString(out, name);
+	AppendString(out, type);
+	Append(out, int32_t(value.size()));
+	out->insert(out->end(), value.begin(), value.end());
+}
+
+}
+
+bool WriteEXR(const std::string& path, int width, int height, const float* pixels, int channels) {
+	if (channels != 1 && channels != 3) { std::cout << "Can only write gray or RGB EXRs, not " << channels << " channels\n"; return false; }
+	std::ofstream file(path, std::ios::binary);
+	if (!file.is_open()) { std::cout << "Couldn't write " << path << "\n"; return false; }
+
+	static const char* gray[1] = { "Y" };
+	static const char* colour[3] = { "B", "G", "R" };	//channels have to be listed and stored in alphabetical order
+	static const int colourIndex[3] = { 2, 1, 0 };		//where B, G, R sit in an RGB pixel
+	const char** names = channels == 1 ? gray : colour;
+
+	std::vector<char> out;
+	Append(&out, uint32_t(20000630));	//magic number
+	Append(&out, uint32_t(2));			//version 2, single part scanline
+	std::vector<char> value;
+	for (int c = 0; c < channels; c++) {
+		AppendString(&value, names[c]);
+		Append(&value, int32_t(2));		//FLOAT
+		Append(&value, uint32_t(0));	//pLinear and three reserved bytes
+		Append(&value, int32_t(1));		//x and y sampling
+		Append(&value, int32_t(1));
+	}
+	value.push_back(0);
+	AppendAttribute(&out, "channels", "chlist", value);
+	AppendAttribute(&out, "compression", "compression", { 0 });	//none, the file gets written while the next frame solves anyway
+	value.clear();
+	for (int32_t corner : { 0, 0, width - 1, height - 1 }) { Append(&value, corner); }
+	AppendAttribute(&out, "dataWindow", "box2i", value);
+	AppendAttribute(&out, "displayWindow", "box2i", value);
+	AppendAttribute(&out, "lineOrder", "lineOrder", { 0 });	//increasing y
+	value.clear();
+	Append(&value, 1.0f);
+	AppendAttribute(&out, "pixelAspectRatio", "float", value);
+	AppendAttribute(&out, "screenWindowWidth", "float", value);
+	value.clear();
+	Append(&value, 0.0f);
+	Append(&value, 0.0f);
+	AppendAttribute(&out, "screenWindowCenter", "v2f", value);
+	out.push_back(0);	//end of the header
+
+	size_t rowBytes = size_t(width) * size_t(channels) * sizeof(float);
+	uint64_t offset = out.size() + size_t(height) * sizeof(uint64_t);	//one block a scanline without compression, each behind its y and size
+	for (int y = 0; y < height; y++) { Append(&out, offset + uint64_t(y) * (8 + rowBytes)); }
+	out.reserve(out.size() + size_t(height) * (8 + rowBytes));
+	for (int y = 0; y < height; y++) {
+		Append(&out, int32_t(y));
+		Append(&out, int32_t(rowBytes));
+		const float* row = pixels + size_t(y) * size_t(width) * size_t(channels);
+		for (int c = 0; c < channels; c++) {	//planar within the scanline, a whole row of one channel then the next
+			int source = channels == 1 ? 0 : colourIndex[c];
+			for (int x = 0; x < width; x++) { Append(&out, row[size_t(x) * size_t(channels) + size_t(source)]); }
+		}
+	}
+	file.write(out.data(), std::streamsize(out.size()));	//one sequential write of the whole file
+	return bool(file);
+}
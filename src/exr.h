@@ -0,0 +1,6 @@
+#pragma once
+#include <string>
+
+//uncompressed scanline OpenEXR of 32 bit float channels, Y for one channel or R, G, B for three, so the linear counts survive without a tone curve
+//pixels holds width * height * channels floats row by row, the same layout Histogram::Pixels has
+bool WriteEXR(const std::string& path, int width, int height, const float* pixels, int channels = 1);
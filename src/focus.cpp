@@ -0,0 +1,68 @@
+#include "focus.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "refract.h"
+
+double ImageSimilarity(std::span<const float> image, std::span<const float> target) {
+	size_t n = std::min(image.size(), target.size());
+	if (n == 0) { return -1; }
+
+	double meanImage = 0, meanTarget = 0;
+	for (size_t i = 0; i < n; i++) { meanImage += image[i]; meanTarget += target[i]; }
+	meanImage /= double(n);
+	meanTarget /= double(n);
+
+	double cross = 0, varianceImage = 0, varianceTarget = 0;
+	for (size_t i = 0; i < n; i++) {
+		double a = image[i] - meanImage, b = target[i] - meanTarget;
+		cross += a * b;
+		varianceImage += a * a;
+		varianceTarget += b * b;
+	}
+	if (varianceImage <= 0 || varianceTarget <= 0) { return -1; }	//a blank image doesn't look like anything
+	return cross / std::sqrt(varianceImage * varianceTarget);
+}
+
+double EvaluateFocus(const IntersectionCache<double>& cache, std::span<const float> target, int targetWidth, int targetHeight, double receiverPlane, Histogram* scratch) {
+	const size_t blockSize = 4096;	//the frame only ever exists a block at a time, so any number of candidates can be scored side by side
+	std::vector<double> blockX(blockSize), blockY(blockSize);
+
+	if (scratch->Width() != targetWidth || scratch->Height() != targetHeight) { scratch->Resize(targetWidth, targetHeight); }
+	scratch->Clear();
+	for (size_t begin = 0; begin < cache.Size(); begin += blockSize) {
+		size_t n = std::min(blockSize, cache.Size() - begin);
+		IntersectRays<double>(cache, begin, std::span<double>(blockX).first(n), std::span<double>(blockY).first(n), receiverPlane);
+		scratch->Add<double>(std::span<const double>(blockX).first(n), std::span<const double>(blockY).first(n), targetWidth / 256.0, targetHeight / 256.0);
+	}
+	return ImageSimilarity(scratch->Pixels(), target);
+}
+
+FocusResult FindFocus(const IntersectionCache<double>& cache, std::span<const float> target, int targetWidth, int targetHeight, double nearest, double farthest, double tolerance, ThreadPool* pool) {
+	std::vector<float> linearTarget(target.begin(), target.end());	//the histogram counts light linearly, the png is gamma encoded
+	for (float& value : linearTarget) { value = std::pow(value, 2.2f); }
+
+	size_t numCandidates = size_t(std::max(8, pool != nullptr ? pool->NumThreads() : 1));
+	std::vector<Histogram> scratch(numCandidates);
+	std::vector<double> similarities(numCandidates);
+
+	FocusResult best;
+	best.distance = nearest;
+	double low = nearest, high = farthest;
+	while (true) {
+		double step = (high - low) / double(numCandidates - 1);
+		auto evaluate = [&](size_t begin, size_t end) {
+			for (size_t c = begin; c < end; c++) { similarities[c] = EvaluateFocus(cache, linearTarget, targetWidth, targetHeight, low + step * double(c), &scratch[c]); }
+		};
+		if (pool != nullptr) { pool->ParallelFor(numCandidates, evaluate, 1); }
+		else { evaluate(0, numCandidates); }
+
+		for (size_t c = 0; c < numCandidates; c++) {
+			if (similarities[c] > best.similarity) { best.similarity = similarities[c]; best.distance = low + step * double(c); }
+		}
+		if (step <= tolerance || !(step > 0)) { return best; }
+		low = std::max(nearest, best.distance - step);	//the peak is somewhere between the neighbours of the best candidate
+		high = std::min(farthest, best.distance + step);
+	}
+}
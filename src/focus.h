@@ -0,0 +1,19 @@
+#pragma once
+#include <span>
+#include "histogram.h"
+#include "raybuffer.h"
+#include "threadpool.h"
+
+struct FocusResult {
+	double distance = 0;
+	double similarity = -1;	//normalized cross correlation with the target, 1 means a perfect match up to brightness and contrast
+};
+
+double ImageSimilarity(std::span<const float> image, std::span<const float> target);
+
+//renders the caustics at receiverPlane into scratch at the target's resolution, streaming the rays through the incremental intersection path, and scores it against the target
+double EvaluateFocus(const IntersectionCache<double>& cache, std::span<const float> target, int targetWidth, int targetHeight, double receiverPlane, Histogram* scratch);
+
+//coarse to fine search for the receiver plane distance in [nearest, farthest] whose caustics look most like the target, every level evaluates a grid of candidates in parallel
+//and then zooms in around the best one until the grid spacing drops below tolerance, target is the gray image as ReadPNG returns it
+FocusResult FindFocus(const IntersectionCache<double>& cache, std::span<const float> target, int targetWidth, int targetHeight, double nearest, double farthest, double tolerance, ThreadPool* pool = nullptr);
@@ -0,0 +1,269 @@
+#include "gpu.h"
+
+#include <algorithm>
+#include <initializer_list>
+#include <iostream>
+#include <vector>
+#include "SDL_opengl.h"
+#include "refract.h"
+
+//GL entry points past 1.1 have to be looked up at run time, SDL already knows how to do that on every platform so there's no extra loader library
+#define CAUSTICS_GL_FUNCTIONS(X) \
+	X(void, Viewport, (GLint, GLint, GLsizei, GLsizei)) \
+	X(void, ClearColor, (GLfloat, GLfloat, GLfloat, GLfloat)) \
+	X(void, Clear, (GLbitfield)) \
+	X(void, DrawArrays, (GLenum, GLint, GLsizei)) \
+	X(GLuint, CreateShader, (GLenum)) \
+	X(void, ShaderSource, (GLuint, GLsizei, const GLchar* const*, const GLint*)) \
+	X(void, CompileShader, (GLuint)) \
+	X(void, GetShaderiv, (GLuint, GLenum, GLint*)) \
+	X(void, GetShaderInfoLog, (GLuint, GLsizei, GLsizei*, GLchar*)) \
+	X(void, DeleteShader, (GLuint)) \
+	X(GLuint, CreateProgram, ()) \
+	X(void, AttachShader, (GLuint, GLuint)) \
+	X(void, LinkProgram, (GLuint)) \
+	X(void, GetProgramiv, (GLuint, GLenum, GLint*)) \
+	X(void, GetProgramInfoLog, (GLuint, GLsizei, GLsizei*, GLchar*)) \
+	X(void, DeleteProgram, (GLuint)) \
+	X(void, UseProgram, (GLuint)) \
+	X(GLint, GetUniformLocation, (GLuint, const GLchar*)) \
+	X(void, Uniform1f, (GLint, GLfloat)) \
+	X(void, Uniform1ui, (GLint, GLuint)) \
+	X(void, Uniform2i, (GLint, GLint, GLint)) \
+	X(void, Uniform2f, (GLint, GLfloat, GLfloat)) \
+	X(void, GenBuffers, (GLsizei, GLuint*)) \
+	X(void, DeleteBuffers, (GLsizei, const GLuint*)) \
+	X(void, BindBuffer, (GLenum, GLuint)) \
+	X(void, BufferData, (GLenum, GLsizeiptr, const void*, GLenum)) \
+	X(void, BindBufferBase, (GLenum, GLuint, GLuint)) \
+	X(void, ClearBufferData, (GLenum, GLenum, GLenum, GLenum, const void*)) \
+	X(void, DispatchCompute, (GLuint, GLuint, GLuint)) \
+	X(void, MemoryBarrier, (GLbitfield)) \
+	X(void, GenVertexArrays, (GLsizei, GLuint*)) \
+	X(void, DeleteVertexArrays, (GLsizei, const GLuint*)) \
+	X(void, BindVertexArray, (GLuint))
+
+#define CAUSTICS_GL_DECLARE(ret, name, params) typedef ret (APIENTRY* name##Proc) params; static name##Proc name = nullptr;
+namespace gl { CAUSTICS_GL_FUNCTIONS(CAUSTICS_GL_DECLARE) }
+#undef CAUSTICS_GL_DECLARE
+
+static const unsigned int workGroupSize = 256;	//has to match local_size_x in the compute shaders
+static const size_t maxRaysPerDispatch = size_t(65535) * workGroupSize;	//65535 is the smallest work group count limit drivers are allowed to have, bigger meshes go through several dispatches
+
+static const char* refractSource = R"(#version 430
+layout(local_size_x = 256) in;
+layout(std430, binding = 3) readonly buffer NX { float nx[]; };
+layout(std430, binding = 4) readonly buffer NY { float ny[]; };
+layout(std430, binding = 5) readonly buffer NZ { float nz[]; };
+layout(std430, binding = 6) writeonly buffer RX { float rx[]; };
+layout(std430, binding = 7) writeonly buffer RY { float ry[]; };
+layout(std430, binding = 8) writeonly buffer RZ { float rz[]; };
+layout(std430, binding = 9) writeonly buffer IRZ { float irz[]; };
+uniform float eta;
+uniform uint rayOffset;
+uniform uint numRays;
+void main() {
+	uint i = gl_GlobalInvocationID.x + rayOffset;
+	if (i >= numRays) { return; }
+	float cosIncidenceAngle = nz[i];
+	float sinRefractedAngle2 = eta * eta * (1.0 - cosIncidenceAngle * cosIncidenceAngle);
+	vec3 refracted = vec3(0.9999, 0.0, 0.0141418);
+	if (sinRefractedAngle2 <= 1.0) {
+		float k = eta * cosIncidenceAngle - sqrt(1.0 - sinRefractedAngle2);
+		refracted = vec3(-k * nx[i], -k * ny[i], eta - k * cosIncidenceAngle);
+	}
+	rx[i] = refracted.x; ry[i] = refracted.y; rz[i] = refracted.z; irz[i] = 1.0 / refracted.z;
+}
+)";
+
+static const char* intersectSource = R"(#version 430
+layout(local_size_x = 256) in;
+layout(std430, binding = 0) readonly buffer VX { float vx[]; };
+layout(std430, binding = 1) readonly buffer VY { float vy[]; };
+layout(std430, binding = 2) readonly buffer VZ { float vz[]; };
+layout(std430, binding = 6) readonly buffer RX { float rx[]; };
+layout(std430, binding = 7) readonly buffer RY { float ry[]; };
+layout(std430, binding = 9) readonly buffer IRZ { float irz[]; };
+layout(std430, binding = 10) buffer Framebuffer { uint pixels[]; };	//ray counts, followed by the number of lit pixels and the number of rays that landed on screen
+uniform float receiverPlane;
+uniform float targetScale;
+uniform vec2 windowScale;
+uniform ivec2 size;
+uniform uint rayOffset;
+uniform uint numRays;
+shared uint onScreen;
+void main() {
+	if (gl_LocalInvocationIndex == 0u) { onScreen = 0u; }
+	barrier();
+
+	uint i = gl_GlobalInvocationID.x + rayOffset;
+	if (i < numRays) {
+		float t = (receiverPlane - vz[i]) * irz[i];
+		vec2 point = (vec2(vx[i] + rx[i] * t, vy[i] + ry[i] * t) * targetScale + targetScale) * windowScale;
+		ivec2 pixel = ivec2(floor(point));
+		if (pixel.x >= 0 && pixel.y >= 0 && pixel.x < size.x && pixel.y < size.y) {
+			uint numPixels = uint(size.x * size.y);
+			if (atomicAdd(pixels[pixel.y * size.x + pixel.x], 1u) == 0u) { atomicAdd(pixels[numPixels], 1u); }	//first ray into this pixel
+			atomicAdd(onScreen, 1u);
+		}
+	}
+
+	barrier();
+	if (gl_LocalInvocationIndex == 0u) { atomicAdd(pixels[uint(size.x * size.y) + 1u], onScreen); }	//one global atomic per work group rather than per ray
+}
+)";
+
+static const char* presentVertexSource = R"(#version 430
+void main() {
+	vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);	//one triangle that covers the whole window
+	gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+}
+)";
+
+static const char* presentFragmentSource = R"(#version 430
+layout(std430, binding = 10) readonly buffer Framebuffer { uint pixels[]; };
+uniform ivec2 size;
+out vec4 color;
+void main() {
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	pixel.y = size.y - 1 - pixel.y;	//SDL's y axis points down, GL's points up
+	uint numPixels = uint(size.x * size.y);
+	float key = pixels[numPixels] > 0u ? float(pixels[numPixels + 1u]) / float(pixels[numPixels]) : 1.0;	//same tone curve as Histogram::ToneMap
+	float count = float(pixels[pixel.y * size.x + pixel.x]);
+	color = vec4(vec3(count / (count + key)), 1.0);
+}
+)";
+
+static GLuint CompileShader(GLenum type, const char* source) {
+	GLuint shader = gl::CreateShader(type);
+	gl::ShaderSource(shader, 1, &source, nullptr);
+	gl::CompileShader(shader);
+	GLint compiled = 0;
+	gl::GetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+	if (!compiled) {
+		char log[1024];
+		gl::GetShaderInfoLog(shader, sizeof(log), nullptr, log);
+		std::cout << "Shader compile failed: " << log << "\n";
+	}
+	return shader;
+}
+
+static GLuint LinkProgram(std::initializer_list<GLuint> shaders) {
+	GLuint program = gl::CreateProgram();
+	for (GLuint shader : shaders) { gl::AttachShader(program, shader); }
+	gl::LinkProgram(program);
+	for (GLuint shader : shaders) { gl::DeleteShader(shader); }
+	GLint linked = 0;
+	gl::GetProgramiv(program, GL_LINK_STATUS, &linked);
+	if (!linked) {
+		char log[1024];
+		gl::GetProgramInfoLog(program, sizeof(log), nullptr, log);
+		std::cout << "Shader link failed: " << log << "\n";
+		gl::DeleteProgram(program);
+		return 0;
+	}
+	return program;
+}
+
+static void DispatchRays(GLuint program, size_t numRays) {	//runs the bound compute program once per ray
+	gl::Uniform1ui(gl::GetUniformLocation(program, "numRays"), GLuint(numRays));
+	GLint offsetLocation = gl::GetUniformLocation(program, "rayOffset");
+	for (size_t offset = 0; offset < numRays; offset += maxRaysPerDispatch) {
+		size_t count = std::min(maxRaysPerDispatch, numRays - offset);
+		gl::Uniform1ui(offsetLocation, GLuint(offset));
+		gl::DispatchCompute(GLuint((count + workGroupSize - 1) / workGroupSize), 1, 1);
+	}
+	gl::MemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+bool GpuSolver::LoadFunctions() {
+#define CAUSTICS_GL_LOAD(ret, name, params) gl::name = reinterpret_cast<gl::name##Proc>(SDL_GL_GetProcAddress("gl" #name)); if (gl::name == nullptr) { return false; }
+	CAUSTICS_GL_FUNCTIONS(CAUSTICS_GL_LOAD)
+#undef CAUSTICS_GL_LOAD
+	return true;
+}
+
+bool GpuSolver::Init(SDL_Window* window) {
+	this->window = window;
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 4);	//compute shaders and shader storage buffers need 4.3
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+	context = SDL_GL_CreateContext(window);
+	if (context == nullptr || !LoadFunctions()) {
+		std::cout << "OpenGL 4.3 isn't available: " << SDL_GetError() << "\n";
+		return false;
+	}
+
+	refractProgram = LinkProgram({ CompileShader(GL_COMPUTE_SHADER, refractSource) });
+	intersectProgram = LinkProgram({ CompileShader(GL_COMPUTE_SHADER, intersectSource) });
+	presentProgram = LinkProgram({ CompileShader(GL_VERTEX_SHADER, presentVertexSource), CompileShader(GL_FRAGMENT_SHADER, presentFragmentSource) });
+	if (refractProgram == 0 || intersectProgram == 0 || presentProgram == 0) { return false; }
+
+	gl::GenBuffers(11, buffers);
+	gl::GenVertexArrays(1, &vertexArray);	//core profile won't draw without one bound, even though the present pass has no vertex data
+	return true;
+}
+
+GpuSolver::~GpuSolver() {
+	if (context == nullptr) { return; }
+	if (gl::DeleteBuffers != nullptr) {
+		gl::DeleteBuffers(11, buffers);
+		gl::DeleteVertexArrays(1, &vertexArray);
+		gl::DeleteProgram(refractProgram);
+		gl::DeleteProgram(intersectProgram);
+		gl::DeleteProgram(presentProgram);
+	}
+	SDL_GL_DeleteContext(context);
+}
+
+void GpuSolver::Upload(const RayBuffer<double>& rays) {
+	numRays = rays.Size();
+	const std::span<const double> components[6] = { rays.vx, rays.vy, rays.vz, rays.nx, rays.ny, rays.nz };
+	std::vector<float> staging(numRays);	//one component at a time, so the host never holds more than one extra float array
+	for (int k = 0; k < 6; k++) {
+		if (k >= 3 && !rays.normalIndex.empty()) { for (size_t i = 0; i < numRays; i++) { staging[i] = float(components[k][rays.normalIndex[i]]); } }	//the shaders want a normal per ray, shared ones get expanded on the way up
+		else { for (size_t i = 0; i < numRays; i++) { staging[i] = float(components[k][i]); } }
+		gl::BindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[k]);
+		gl::BufferData(GL_SHADER_STORAGE_BUFFER, GLsizeiptr(numRays * sizeof(float)), staging.data(), GL_STATIC_DRAW);
+	}
+	for (int k = 6; k < 10; k++) {
+		gl::BindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[k]);
+		gl::BufferData(GL_SHADER_STORAGE_BUFFER, GLsizeiptr(numRays * sizeof(float)), nullptr, GL_DYNAMIC_COPY);
+	}
+	for (int k = 0; k < 10; k++) { gl::BindBufferBase(GL_SHADER_STORAGE_BUFFER, GLuint(k), buffers[k]); }
+}
+
+void GpuSolver::Refract(double eta) {
+	gl::UseProgram(refractProgram);
+	gl::Uniform1f(gl::GetUniformLocation(refractProgram, "eta"), float(eta));
+	DispatchRays(refractProgram, numRays);
+}
+
+void GpuSolver::Draw(double receiverPlane, int width, int height) {
+	size_t numPixels = size_t(width) * size_t(height) + 2;	//the two counters the tone curve needs live in the last two entries
+	if (numPixels != framebufferSize) {	//the framebuffer follows the window size, same as DrawIntersections scaling the points up
+		framebufferSize = numPixels;
+		gl::BindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[10]);
+		gl::BufferData(GL_SHADER_STORAGE_BUFFER, GLsizeiptr(numPixels * sizeof(GLuint)), nullptr, GL_DYNAMIC_COPY);
+		gl::BindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, buffers[10]);
+	}
+	GLuint zero = 0;
+	gl::BindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[10]);
+	gl::ClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+
+	gl::UseProgram(intersectProgram);
+	gl::Uniform1f(gl::GetUniformLocation(intersectProgram, "receiverPlane"), float(receiverPlane));
+	gl::Uniform1f(gl::GetUniformLocation(intersectProgram, "targetScale"), float(targetScale));
+	gl::Uniform2f(gl::GetUniformLocation(intersectProgram, "windowScale"), width / 256.0f, height / 256.0f);
+	gl::Uniform2i(gl::GetUniformLocation(intersectProgram, "size"), width, height);
+	DispatchRays(intersectProgram, numRays);
+
+	gl::Viewport(0, 0, width, height);
+	gl::ClearColor(0, 0, 0, 1);
+	gl::Clear(GL_COLOR_BUFFER_BIT);
+	gl::UseProgram(presentProgram);
+	gl::Uniform2i(gl::GetUniformLocation(presentProgram, "size"), width, height);
+	gl::BindVertexArray(vertexArray);
+	gl::DrawArrays(GL_TRIANGLES, 0, 3);
+	SDL_GL_SwapWindow(window);
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <cstddef>
+#include "SDL.h"
+#include "raybuffer.h"
+
+class GpuSolver {	//OpenGL 4.3 compute backend, keeps the rays resident on the device and draws the intersections straight into the buffer it presents, nothing comes back to the host
+public:
+	GpuSolver() = default;
+	~GpuSolver();
+	GpuSolver(const GpuSolver&) = delete;
+	GpuSolver& operator=(const GpuSolver&) = delete;
+
+	bool Init(SDL_Window* window);				//creates a GL context on a window made with SDL_WINDOW_OPENGL, returns false if the driver can't do compute shaders
+	void Upload(const RayBuffer<double>& rays);	//copies the vertices and normals to the device as floats
+	void Refract(double eta);					//same math as RefractRays, the refracted directions stay on the device
+	void Draw(double receiverPlane, int width, int height);	//intersects with the receiver plane, splats into the framebuffer and presents it
+
+private:
+	bool LoadFunctions();
+
+	SDL_Window* window = nullptr;
+	void* context = nullptr;
+	unsigned int refractProgram = 0, intersectProgram = 0, presentProgram = 0;
+	unsigned int buffers[11] = {};	//vx, vy, vz, nx, ny, nz, rx, ry, rz, irz and the framebuffer, in shader binding order
+	unsigned int vertexArray = 0;
+	size_t numRays = 0;
+	size_t framebufferSize = 0;
+};
@@ -0,0 +1,72 @@
+#include "heightfield.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include "mappedfile.h"
+#include "png.h"
+
+static bool EndsWith(const std::string& text, const std::string& suffix) { return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0; }
+
+bool IsHeightfieldPath(const std::string& path) { return EndsWith(path, ".png") || EndsWith(path, ".f32"); }
+
+bool ReadHeightfield(const std::string& path, double relief, Heightfield* field) {
+	if (EndsWith(path, ".png")) {
+		std::vector<float> gray;
+		if (!ReadPNG(path, &field->width, &field->height, &gray)) { return false; }
+		field->heights.resize(gray.size());
+		for (size_t i = 0; i < gray.size(); i++) { field->heights[i] = gray[i] * relief; }
+	}
+	else {
+		MappedFile file(path);
+		if (!file.IsOpen()) { std::cout << "Couldn't open " << path << "\n"; return false; }
+		size_t count = file.Size() / sizeof(float);
+		int side = int(std::lround(std::sqrt(double(count))));
+		if (count * sizeof(float) != file.Size() || size_t(side) * size_t(side) != count) { std::cout << path << " isn't a square grid of float32 heights\n"; return false; }
+		field->width = field->height = side;
+		field->heights.resize(count);
+		for (size_t i = 0; i < count; i++) {
+			float value;
+			std::memcpy(&value, file.Data() + i * sizeof(float), sizeof(float));
+			field->heights[i] = value * relief;
+		}
+	}
+	if (field->width < 2 || field->height < 2) { std::cout << path << " needs at least 2x2 heights to have slopes\n"; return false; }
+	return true;
+}
+
+void HeightfieldMesh(const Heightfield& field, RayBuffer<double>* mesh, ThreadPool* pool) {
+	int width = field.width, height = field.height;
+	mesh->Resize(field.Size());
+	double* components[6];
+	for (int k = 0; k < 6; k++) { components[k] = mesh->MeshComponent(k); }
+	double dx = 2.0 / (width - 1), dy = 2.0 / (height - 1);
+	auto fill = [&](size_t begin, size_t end) {
+		for (size_t row = begin; row < end; row++) {
+			int r = int(row), up = std::max(r - 1, 0), down = std::min(r + 1, height - 1);
+			for (int c = 0; c < width; c++) {
+				int left = std::max(c - 1, 0), right = std::min(c + 1, width - 1);	//one sided at the edges, same as the kernel
+				size_t i = row * size_t(width) + size_t(c);
+				double slopeX = (field.heights[row * size_t(width) + size_t(right)] - field.heights[row * size_t(width) + size_t(left)]) / ((right - left) * dx);
+				double slopeY = (field.heights[size_t(down) * size_t(width) + size_t(c)] - field.heights[size_t(up) * size_t(width) + size_t(c)]) / ((down - up) * dy);
+				double inverseLength = 1 / std::sqrt(slopeX * slopeX + slopeY * slopeY + 1);
+				components[0][i] = field.X(c); components[1][i] = field.Y(r); components[2][i] = field.heights[i];
+				components[3][i] = -slopeX * inverseLength; components[4][i] = -slopeY * inverseLength; components[5][i] = inverseLength;
+			}
+		}
+	};
+	if (pool != nullptr) { pool->ParallelFor(size_t(height), fill); }
+	else { fill(0, size_t(height)); }
+
+	mesh->triangleStorage.resize(6 * size_t(width - 1) * size_t(height - 1));	//two triangles per grid cell
+	uint32_t* corner = mesh->triangleStorage.data();
+	for (int r = 0; r + 1 < height; r++) {
+		for (int c = 0; c + 1 < width; c++) {
+			uint32_t a = uint32_t(r * width + c), b = a + 1, d = a + uint32_t(width), e = d + 1;
+			*corner++ = a; *corner++ = b; *corner++ = e;
+			*corner++ = a; *corner++ = e; *corner++ = d;
+		}
+	}
+	mesh->triangles = mesh->triangleStorage;
+}
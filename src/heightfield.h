@@ -0,0 +1,22 @@
+#pragma once
+#include <string>
+#include "raybuffer.h"
+#include "threadpool.h"
+
+struct Heightfield {	//a lens surface given as heights over a regular grid spanning (-1, 1) in x and y, row 0 at y = -1 like the rows of the target image
+	int width = 0;
+	int height = 0;
+	RayArray<double> heights;	//row by row, one ray per sample
+
+	size_t Size() const { return heights.size(); }
+	double X(int column) const { return -1 + 2.0 * column / (width - 1); }
+	double Y(int row) const { return -1 + 2.0 * row / (height - 1); }
+};
+
+bool IsHeightfieldPath(const std::string& path);	//.png or .f32, everything else is read as an obj
+
+//a 16 bit (or any) grayscale PNG, where white is relief lens units high, or raw little endian float32 heights of a square grid, multiplied by relief
+bool ReadHeightfield(const std::string& path, double relief, Heightfield* field);
+
+//the same surface as a triangle mesh with finite difference normals, for everything that needs actual vertices: triangles, lights, a second surface, the GPU
+void HeightfieldMesh(const Heightfield& field, RayBuffer<double>* mesh, ThreadPool* pool = nullptr);
@@ -0,0 +1,169 @@
+#include "histogram.h"
+
+#include <algorithm>
+#include <cmath>
+#include "profile.h"
+
+void Histogram::Resize(int width, int height, int channels) {
+	this->width = width;
+	this->height = height;
+	this->channels = channels;
+	pixels.assign(size_t(width) * size_t(height) * size_t(channels), 0.0f);
+	partials.clear();
+}
+
+template <typename T>
+static void Bin(std::span<const T> ix, std::span<const T> iy, T scaleX, T scaleY, int width, int height, float* pixels) {
+	const T maxX = T(width), maxY = T(height);
+	for (size_t i = 0; i < ix.size(); i++) {
+		T x = ix[i] * scaleX, y = iy[i] * scaleY;
+		if (!(x >= 0 && x < maxX && y >= 0 && y < maxY)) { continue; }	//written this way round so NaNs get dropped too
+		pixels[size_t(y) * size_t(width) + size_t(x)] += 1.0f;
+	}
+}
+
+template <typename T>
+static void BinColored(std::span<const T> ix, std::span<const T> iy, std::span<const float> colors, size_t first, T scaleX, T scaleY, int width, int height, int channels, float* pixels) {	//first is the index of ix[0] in the whole solve, which decides the colour
+	const T maxX = T(width), maxY = T(height);
+	const size_t stride = colors.size() / size_t(channels);
+	size_t color = first % stride;
+	for (size_t i = 0; i < ix.size(); i++, color = color + 1 == stride ? 0 : color + 1) {
+		T x = ix[i] * scaleX, y = iy[i] * scaleY;
+		if (!(x >= 0 && x < maxX && y >= 0 && y < maxY)) { continue; }
+		float* pixel = pixels + (size_t(y) * size_t(width) + size_t(x)) * size_t(channels);
+		const float* weight = colors.data() + color * size_t(channels);
+		for (int c = 0; c < channels; c++) { pixel[c] += weight[c]; }
+	}
+}
+
+template <typename T>
+void Histogram::Accumulate(std::span<const T> ix, std::span<const T> iy, double scaleX, double scaleY, ThreadPool* pool) {
+	Clear();
+	Add(ix, iy, scaleX, scaleY, pool);
+}
+
+void Histogram::Clear() {
+	std::fill(pixels.begin(), pixels.end(), 0.0f);
+}
+
+template <typename T>
+static void Rasterize(std::span<const T> ix, std::span<const T> iy, std::span<const uint32_t> triangles, std::span<const T> flux, size_t begin, size_t end, T scaleX, T scaleY, int width, int height, float* pixels) {
+	for (size_t t = begin; t < end; t++) {
+		uint32_t a = triangles[3 * t], b = triangles[3 * t + 1], c = triangles[3 * t + 2];
+		T x0 = ix[a] * scaleX, y0 = iy[a] * scaleY, x1 = ix[b] * scaleX, y1 = iy[b] * scaleY, x2 = ix[c] * scaleX, y2 = iy[c] * scaleY;
+		T minX = std::min({ x0, x1, x2 }), maxX = std::max({ x0, x1, x2 }), minY = std::min({ y0, y1, y2 }), maxY = std::max({ y0, y1, y2 });
+		if (!(maxX >= 0 && minX < T(width) && maxY >= 0 && minY < T(height))) { continue; }	//off screen, or NaN
+		if (maxX - minX > T(width) || maxY - minY > T(height)) { continue; }	//smeared across more than the whole view, one of its rays left through total internal reflection
+
+		//pixels whose centers are inside, counted over the whole projection but only written where on screen, so the flux on screen is exactly what belongs there
+		T area = (x1 - x0) * (y2 - y0) - (x2 - x0) * (y1 - y0);	//twice the signed area, the edge functions below take its sign so either winding works
+		T sign = area < 0 ? T(-1) : T(1);
+		auto inside = [&](T px, T py) {
+			T w0 = ((x2 - x1) * (py - y1) - (y2 - y1) * (px - x1)) * sign;
+			T w1 = ((x0 - x2) * (py - y2) - (y0 - y2) * (px - x2)) * sign;
+			T w2 = ((x1 - x0) * (py - y0) - (y1 - y0) * (px - x0)) * sign;
+			return w0 >= 0 && w1 >= 0 && w2 >= 0;
+		};
+		long long firstX = (long long)std::ceil(minX - T(0.5)), lastX = (long long)std::floor(maxX - T(0.5));
+		long long firstY = (long long)std::ceil(minY - T(0.5)), lastY = (long long)std::floor(maxY - T(0.5));
+		size_t covered = 0;
+		if (area != 0) {
+			for (long long y = firstY; y <= lastY; y++) {
+				for (long long x = firstX; x <= lastX; x++) { covered += inside(T(x) + T(0.5), T(y) + T(0.5)); }
+			}
+		}
+		if (covered == 0) {	//smaller than a pixel, all of it goes where its centroid is
+			T cx = (x0 + x1 + x2) / 3, cy = (y0 + y1 + y2) / 3;
+			if (cx >= 0 && cx < T(width) && cy >= 0 && cy < T(height)) { pixels[size_t(cy) * size_t(width) + size_t(cx)] += float(flux[t] * scaleX * scaleY); }
+			continue;
+		}
+		float energy = float(flux[t] * scaleX * scaleY / T(covered));
+		for (long long y = std::max(firstY, 0ll); y <= std::min(lastY, (long long)height - 1); y++) {
+			for (long long x = std::max(firstX, 0ll); x <= std::min(lastX, (long long)width - 1); x++) {
+				if (inside(T(x) + T(0.5), T(y) + T(0.5))) { pixels[size_t(y) * size_t(width) + size_t(x)] += energy; }
+			}
+		}
+	}
+}
+
+template <typename T>
+void Histogram::Add(std::span<const T> ix, std::span<const T> iy, double scaleX, double scaleY, ThreadPool* pool) {
+	Splat(ix.size(), [&](size_t begin, size_t end, float* out) {
+		Bin<T>(ix.subspan(begin, end - begin), iy.subspan(begin, end - begin), T(scaleX), T(scaleY), width, height, out);
+	}, pool);
+}
+
+template <typename T>
+void Histogram::AddColored(std::span<const T> ix, std::span<const T> iy, std::span<const float> colors, double scaleX, double scaleY, ThreadPool* pool) {
+	if (colors.size() < size_t(channels)) { return; }
+	Splat(ix.size(), [&](size_t begin, size_t end, float* out) {
+		BinColored<T>(ix.subspan(begin, end - begin), iy.subspan(begin, end - begin), colors, begin, T(scaleX), T(scaleY), width, height, channels, out);
+	}, pool);
+}
+
+template <typename T>
+void Histogram::AddTriangles(std::span<const T> ix, std::span<const T> iy, std::span<const uint32_t> triangles, std::span<const T> flux, double scaleX, double scaleY, ThreadPool* pool) {
+	Splat(triangles.size() / 3, [&](size_t begin, size_t end, float* out) {
+		Rasterize<T>(ix, iy, triangles, flux, begin, end, T(scaleX), T(scaleY), width, height, out);
+	}, pool);
+}
+
+void Histogram::Splat(size_t count, const std::function<void(size_t, size_t, float*)>& splat, ThreadPool* pool) {
+	PROFILE_SCOPE("bin");
+	size_t numPixels = pixels.size();
+	size_t numPartials = pool == nullptr ? 1 : std::min(size_t(pool->NumThreads()), std::max(size_t(1), count / std::max(size_t(1), numPixels)));	//a scratch image only pays off once it gets at least a pixel's worth of work, so memory stays bounded by the work instead of growing threads x pixels
+	if (numPartials == 1) {
+		splat(0, count, pixels.data());
+		return;
+	}
+
+	partials.resize(numPartials);
+	pool->ParallelFor(numPartials, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			partials[i].assign(numPixels, 0.0f);
+			splat(count * i / numPartials, count * (i + 1) / numPartials, partials[i].data());
+		}
+	}, 1);
+	pool->ParallelFor(numPixels, [&](size_t begin, size_t end) {	//add the partials on top of what was there, split by pixel this time so each thread owns its output range
+		for (const std::vector<float>& partial : partials) {
+			for (size_t p = begin; p < end; p++) { pixels[p] += partial[p]; }
+		}
+	});
+	for (std::vector<float>& partial : partials) { partial.clear(); }
+}
+
+template void Histogram::Add<float>(std::span<const float>, std::span<const float>, double, double, ThreadPool*);
+template void Histogram::Add<double>(std::span<const double>, std::span<const double>, double, double, ThreadPool*);
+template void Histogram::AddColored<float>(std::span<const float>, std::span<const float>, std::span<const float>, double, double, ThreadPool*);
+template void Histogram::AddColored<double>(std::span<const double>, std::span<const double>, std::span<const float>, double, double, ThreadPool*);
+template void Histogram::AddTriangles<float>(std::span<const float>, std::span<const float>, std::span<const uint32_t>, std::span<const float>, double, double, ThreadPool*);
+template void Histogram::AddTriangles<double>(std::span<const double>, std::span<const double>, std::span<const uint32_t>, std::span<const double>, double, double, ThreadPool*);
+template void Histogram::Accumulate<float>(std::span<const float>, std::span<const float>, double, double, ThreadPool*);
+template void Histogram::Accumulate<double>(std::span<const double>, std::span<const double>, double, double, ThreadPool*);
+
+void Histogram::ToneMap(uint32_t* argb, int pitch, ThreadPool* pool) const {
+	PROFILE_SCOPE("tone map");
+	double total = 0;
+	size_t lit = 0;
+	for (size_t p = 0; p < pixels.size(); p += size_t(channels)) {
+		float count = 0;
+		for (int c = 0; c < channels; c++) { count += pixels[p + c]; }
+		total += count;
+		lit += count > 0;
+	}
+	float key = lit > 0 ? float(total / (double(lit) * channels)) : 1.0f;	//mean count of the pixels that got any light at all, one shared key so colours keep their balance
+
+	const int green = std::min(1, channels - 1), blue = std::min(2, channels - 1);	//a single channel goes into all three
+	auto map = [&](size_t begin, size_t end) {
+		for (size_t row = begin; row < end; row++) {
+			const float* in = pixels.data() + row * size_t(width) * size_t(channels);
+			uint32_t* out = argb + row * size_t(pitch);
+			for (int x = 0; x < width; x++, in += channels) {
+				auto tone = [&](float count) { return uint32_t(255.0f * count / (count + key)); };	//reinhard curve, dense caustic lines compress towards white instead of everything saturating
+				out[x] = 0xFF000000u | (tone(in[0]) << 16) | (tone(in[green]) << 8) | tone(in[blue]);
+			}
+		}
+	};
+	if (pool != nullptr) { pool->ParallelFor(size_t(height), map); }
+	else { map(0, size_t(height)); }
+}
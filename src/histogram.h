@@ -0,0 +1,49 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <vector>
+#include "threadpool.h"
+
+class Histogram {	//counts how many rays land in each pixel, the density of the intersections is what actually makes the caustic
+public:
+	void Resize(int width, int height, int channels = 1);	//channels 3 for an RGB image, pixel (x, y) then owns [(y * width + x) * channels, + channels) of Pixels
+	int Width() const { return width; }
+	int Height() const { return height; }
+	int Channels() const { return channels; }
+	std::span<const float> Pixels() const { return pixels; }
+
+	//clears and bins target image coordinates into pixels after scaling them by scaleX/scaleY, rays that land off screen are dropped
+	//Accumulate, Add and AddTriangles are for single channel histograms
+	//with a pool every thread fills its own private histogram and those get summed afterwards, so there are no atomics in the hot loop
+	template <typename T>
+	void Accumulate(std::span<const T> ix, std::span<const T> iy, double scaleX, double scaleY, ThreadPool* pool = nullptr);
+
+	void Clear();
+	template <typename T>
+	void Add(std::span<const T> ix, std::span<const T> iy, double scaleX, double scaleY, ThreadPool* pool = nullptr);	//same as Accumulate but without clearing first, for building a histogram up a block of rays at a time
+
+	//flux conserving alternative to binning vertices, spreads the flux of every triangle evenly over the pixels its projection covers, so a coarse mesh still gives smooth irradiance
+	//triangles are three indices into ix/iy each, flux is per triangle in target image units squared, a flat window comes out at 1 per pixel, without clearing first
+	template <typename T>
+	void AddTriangles(std::span<const T> ix, std::span<const T> iy, std::span<const uint32_t> triangles, std::span<const T> flux, double scaleX, double scaleY, ThreadPool* pool = nullptr);
+
+	//bins rays that each carry a colour, ray i adds colors[(i % stride) * channels + c] to channel c where stride = colors.size() / channels, without clearing first
+	//for the spectral solve, where the rays come as stride wavelengths per vertex
+	template <typename T>
+	void AddColored(std::span<const T> ix, std::span<const T> iy, std::span<const float> colors, double scaleX, double scaleY, ThreadPool* pool = nullptr);
+
+	void ToneMap(uint32_t* argb, int pitch, ThreadPool* pool = nullptr) const;	//writes opaque ARGB8888 pixels, gray for one channel, pitch is in pixels, the average lit pixel comes out mid gray
+
+	//runs splat(begin, end, pixels) over [0, count) of whatever the caller splits its work into, splat adds its light into the width * height pixels it's given
+	//with a pool every thread gets a private partial image that is added on top afterwards, for light sources that aren't a plain list of intersections
+	void Splat(size_t count, const std::function<void(size_t, size_t, float*)>& splat, ThreadPool* pool = nullptr);
+
+private:
+	int width = 0;
+	int height = 0;
+	int channels = 1;
+	std::vector<float> pixels;
+	std::vector<std::vector<float>> partials;	//scratch histograms, at most one per thread and one per pixel's worth of splats, kept around so repeated solves don't reallocate them
+};
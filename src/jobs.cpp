@@ -0,0 +1,167 @@
+#include "jobs.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "heightfield.h"
+#include "histogram.h"
+#include "light.h"
+#include "meshcache.h"
+#include "output.h"
+#include "png.h"
+#include "refract.h"
+#include "threadpool.h"
+#include "writer.h"
+
+struct LensJob {
+	std::string lens;
+	std::vector<std::pair<double, std::string>> outputs;	//distance and the prefix its image gets written under, from every line naming this lens
+};
+
+class WorkQueues {	//one deque of jobs per thread, a thread takes its own from the front and steals from the back of the others once it runs dry
+public:
+	WorkQueues(size_t numJobs, int numThreads) : queues(numThreads), locks(numThreads) {
+		for (size_t job = 0; job < numJobs; job++) { queues[job * numThreads / numJobs].push_back(job); }	//contiguous runs like ParallelFor, the stealing evens out lenses of different sizes
+	}
+
+	bool Next(int thread, size_t* job) {
+		{
+			std::lock_guard<std::mutex> lock(locks[thread]);
+			if (!queues[thread].empty()) { *job = queues[thread].front(); queues[thread].pop_front(); return true; }
+		}
+		for (size_t k = 1; k < queues.size(); k++) {	//the other threads' queues, starting with the next one so the thieves spread out
+			size_t victim = (thread + k) % queues.size();
+			std::lock_guard<std::mutex> lock(locks[victim]);
+			if (!queues[victim].empty()) { *job = queues[victim].back(); queues[victim].pop_back(); return true; }
+		}
+		return false;	//nothing gets added once the threads start, so empty everywhere means done
+	}
+
+private:
+	std::vector<std::deque<size_t>> queues;
+	std::vector<std::mutex> locks;
+};
+
+static bool ReadJobs(const std::string& path, std::vector<LensJob>* jobs) {
+	std::ifstream file(path);
+	if (!file.is_open()) { std::cout << "Couldn't read job file " << path << "\n"; return false; }
+	std::map<std::string, size_t> byLens;
+	std::string line;
+	for (size_t number = 1; std::getline(file, line); number++) {
+		line = line.substr(0, line.find('#'));
+		std::istringstream fields(line);
+		std::string lens, distances, prefix;
+		if (!(fields >> lens)) { continue; }	//blank or comment only
+		std::vector<double> parsed;
+		if (fields >> distances >> prefix) { parsed = ParseDistances(distances); }
+		if (parsed.empty()) { std::cout << path << ":" << number << ": expected lens distances prefix\n"; return false; }
+		auto [entry, added] = byLens.emplace(lens, jobs->size());
+		if (added) { jobs->push_back({ lens, {} }); }
+		for (double distance : parsed) { (*jobs)[entry->second].outputs.push_back({ distance, prefix }); }
+	}
+	return true;
+}
+
+//loads, refracts and solves one lens on the calling thread, the lenses themselves are what runs in parallel
+static bool RunLens(const LensJob& job, int width, int height, bool useMeshCache, AsyncWriter* writer, std::mutex* log) {
+	MeshCache meshCache;
+	RayBuffer<double> rays;
+	Heightfield field;
+	IntersectionCache<double> cache;
+	auto fail = [&](const std::string& message) {
+		std::lock_guard<std::mutex> lock(*log);
+		std::cout << job.lens << ": " << message << "\n";
+		return false;
+	};
+
+	if (IsHeightfieldPath(job.lens)) {
+		if (!ReadHeightfield(job.lens, 1, &field)) { return fail("couldn't read the heightfield"); }
+		PrepareIntersections(field, glassEta, &cache);
+	}
+	else {
+		if (useMeshCache && meshCache.Open(job.lens)) { meshCache.View(&rays); }
+		else {
+			std::vector<Eigen::Vector3d> vertices;
+			std::vector<Eigen::Vector3d> normals;
+			ParseOBJ(job.lens, &vertices, &normals);
+			if (vertices.empty()) { return fail("no vertices read"); }
+			if (normals.size() != vertices.size()) { return fail(std::to_string(vertices.size()) + " vertices but " + std::to_string(normals.size()) + " normals"); }
+			FillRayBuffer(vertices, normals, &rays);
+			if (useMeshCache) { MeshCache::Write(job.lens, rays); }
+		}
+		Light beam;
+		PrepareIntersections<double>(rays, std::span<const Light>(&beam, 1), glassEta, &cache);
+	}
+
+	RayArray<double> intersectionsX(cache.Size());
+	RayArray<double> intersectionsY(cache.Size());
+	Histogram image;
+	image.Resize(width, height);
+	for (const auto& [distance, prefix] : job.outputs) {
+		IntersectRays<double>(cache, intersectionsX, intersectionsY, distance);
+		image.Accumulate<double>(intersectionsX, intersectionsY, width / 256.0, height / 256.0);	//same mapping as the window
+		auto pixels = std::make_shared<std::vector<unsigned char>>(ImageBytes(image));	//tone mapped here, the writer only encodes and writes
+		std::string name = OutputName(prefix, distance);
+		writer->Submit([pixels, name, width, height, log] {
+			bool ok = WritePNG(name + ".png", width, height, pixels->data());
+			std::lock_guard<std::mutex> lock(*log);
+			std::cout << (ok ? "Wrote " : "Couldn't write ") << name << "\n";
+			return ok;
+		});
+	}
+	return true;
+}
+
+int RunJobs(int argc, char** argv) {
+	if (argc < 1) { std::cout << "--jobs needs a job file\n"; return 1; }
+	int numThreads = 0;
+	int width = 256, height = 256;
+	bool useMeshCache = true;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if ((arg == "--threads" || arg == "-t") && i + 1 < argc) { numThreads = std::stoi(argv[++i]); }
+		else if (arg == "--size" && i + 2 < argc) { width = std::stoi(argv[i + 1]); height = std::stoi(argv[i + 2]); i += 2; }
+		else if (arg == "--no-cache") { useMeshCache = false; }
+		else { std::cout << "Unknown argument " << arg << "\n"; }
+	}
+
+	std::vector<LensJob> jobs;
+	if (!ReadJobs(argv[0], &jobs)) { return 1; }
+	if (jobs.empty()) { std::cout << "No jobs in " << argv[0] << "\n"; return 0; }
+	if (numThreads <= 0) { numThreads = ThreadPool::AvailableThreads(); }
+	numThreads = std::min(numThreads, int(jobs.size()));
+
+	auto start = std::chrono::steady_clock::now();
+	AsyncWriter writer(4 * size_t(numThreads));	//a few images per thread in flight, beyond that the solvers wait for the disk
+	WorkQueues queues(jobs.size(), numThreads);
+	std::mutex log;
+	std::atomic<int> failures{ 0 };
+	std::vector<std::thread> threads;
+	for (int t = 0; t < numThreads; t++) {
+		threads.emplace_back([&, t] {
+			size_t job;
+			while (queues.Next(t, &job)) {
+				if (!RunLens(jobs[job], width, height, useMeshCache, &writer, &log)) { failures++; }
+			}
+		});
+	}
+	for (std::thread& thread : threads) { thread.join(); }
+	if (!writer.Flush()) { failures++; }
+
+	size_t numImages = 0;
+	for (const LensJob& job : jobs) { numImages += job.outputs.size(); }
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << jobs.size() << " lenses, " << numImages << " images in " << seconds << "s on " << numThreads << " threads" << (failures > 0 ? ", with failures" : "") << "\n";
+	return failures > 0 ? 1 : 0;
+}
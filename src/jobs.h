@@ -0,0 +1,7 @@
+#pragma once
+
+//headless batch over many lenses, run as caustics --jobs jobs.txt [options], every line of the job file is "lens distances prefix"
+//like "lens.obj 2.5,3,3.5 out/lens" writing out/lens_<distance>.png, lines naming the same lens get loaded and refracted only once, # starts a comment
+//lenses run one per thread with work stealing between the threads, and the images get written on a thread of their own while the next ones are solved
+//--threads n like the viewer, --size W H of the written images, --no-cache always parses the obj text
+int RunJobs(int argc, char** argv);	//argc/argv are the arguments after --jobs, returns the exit code
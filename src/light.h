@@ -0,0 +1,11 @@
+#pragma once
+#include "Eigen/Core"
+
+struct Light {	//one light source shining onto the lens, several of them can go through a single solve
+	enum Kind { collimated, point };
+	Kind kind = collimated;
+	Eigen::Vector3d direction = Eigen::Vector3d(0, 0, 1);	//normalized direction a collimated beam travels in
+	Eigen::Vector3d position = Eigen::Vector3d::Zero();		//where a point light sits, every vertex sees it from its own direction
+
+	bool IsAlongZ() const { return kind == collimated && direction == Eigen::Vector3d(0, 0, 1); }	//what Refract assumes, the kernels have a specialized path for it
+};
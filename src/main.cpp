@@ -1,79 +1,549 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
+#include <memory>
 #include <fstream>
+#include <span>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 #include "Eigen/Core"
 #include "SDL.h"
+#include "bvh.h"
+#include "design.h"
+#include "focus.h"
+#include "gpu.h"
+#include "heightfield.h"
+#include "histogram.h"
+#include "jobs.h"
+#include "light.h"
+#include "meshcache.h"
+#include "output.h"
+#include "png.h"
+#include "profile.h"
 #include "refract.h"
+#include "solver.h"
+#include "spatialsort.h"
+#include "spectrum.h"
+#include "stream.h"
+#include "supersample.h"
+#include "threadpool.h"
+#include "writer.h"
 
-const double eta = 1.457;	//refractive index that was used to generate the lens
+const double eta = glassEta;	//refractive index that was used to generate the lens
 int windowWidth = 256;		//dimensions of the display window
 int windowHeight = 256;
 
-void DrawIntersections(SDL_Renderer* renderer, std::vector<Eigen::Vector2d> intersections) {	//display the intersections onto the window
-	int numPoints = int(intersections.size());
-	float scaleX = windowWidth / 256.0f;		//initially, we draw to a 256x256 window, but we want to be able to account for changing the window size
-	float scaleY = windowHeight / 256.0f;
+Histogram histogram;		//per-pixel ray counts at window resolution, only touched by the solver thread
+SDL_Texture* texture = nullptr;	//the streaming texture finished frames get uploaded through, on the UI thread
+int textureWidth = 0, textureHeight = 0;
 
-	SDL_SetRenderDrawColor(renderer, 0x00, 0x00, 0x00, 0xFF);	//clear the screen with black
-	SDL_RenderClear(renderer);
+ExportOptions exportOptions;			//what --output writes for every distance and e writes from the window
+std::string exportPrefix = "caustics";	//where e in the window writes to, prefix_<distance> like --output
+AsyncWriter* exportWriter = nullptr;	//the window's writer thread, so an export never holds up the next frame
+std::atomic<bool> exportRequested{ false };	//set by e on the UI thread, taken by the next full frame the solver finishes
+
+std::span<const uint32_t> triangles;	//with --triangles the mesh triangles get rasterized with their flux instead of binning one ray per vertex, empty otherwise
+RayArray<double> triangleFlux;
+int samplesPerSide = 0;					//with --samples k every triangle shoots k * k interpolated rays instead, generated on the fly from sampledRays each frame
+const RayBuffer<double>* sampledRays = nullptr;
+std::span<const float> rayColors;		//with --spectral every vertex shoots one ray per wavelength and they get binned in their colours into an RGB image, empty otherwise
+
+template <typename T>
+void Splat(Histogram* image, std::span<const T> intersectionsX, std::span<const T> intersectionsY, double receiverPlane, double scaleX, double scaleY, ThreadPool* pool) {	//clears the image and puts the light of one solve into it, triangles only come in double
+	if (!rayColors.empty()) { image->Clear(); image->AddColored(intersectionsX, intersectionsY, rayColors, scaleX, scaleY, pool); return; }
+	if (samplesPerSide > 0) { SupersampleCaustics(*sampledRays, triangleFlux, samplesPerSide, eta, receiverPlane, image, pool); return; }	//doesn't use the per-vertex intersections at all
+	if (triangleFlux.empty()) { image->Accumulate(intersectionsX, intersectionsY, scaleX, scaleY, pool); return; }
+	image->Clear();
+	if constexpr (std::is_same_v<T, double>) {
+		size_t numVertices = sampledRays->Size();
+		for (size_t begin = 0; begin + numVertices <= intersectionsX.size(); begin += numVertices) {	//every light's rays form their own copy of the mesh
+			image->AddTriangles<double>(intersectionsX.subspan(begin, numVertices), intersectionsY.subspan(begin, numVertices), triangles, triangleFlux, scaleX, scaleY, pool);
+		}
+	}
+}
+
+#ifdef CAUSTICS_PROFILE
+bool profileOverlay = false;	//p toggles a bar per stage of the last frame over the caustics, 20 pixels per millisecond, with the numbers in the title bar in the same order
+
+void DrawProfileBars(SDL_Renderer* renderer) {
+	int y = 4;
+	for (const ProfileEntry& entry : Profiler::LastFrame()) {
+		if (entry.counter) { continue; }
+		uint32_t hue = 2166136261u;	//colour from the name so a stage keeps its colour from frame to frame
+		for (const char* c = entry.name; *c != 0; c++) { hue = (hue ^ uint8_t(*c)) * 16777619u; }
+		SDL_SetRenderDrawColor(renderer, 0x80 | (hue & 0x7F), 0x80 | ((hue >> 8) & 0x7F), 0x80 | ((hue >> 16) & 0x7F), 0xFF);
+		SDL_Rect bar = { 4, y, std::clamp(int(entry.value * 20), 1, std::max(1, windowWidth - 8)), 6 };
+		SDL_RenderFillRect(renderer, &bar);
+		y += 8;
+	}
+}
+
+std::string ProfileTitle() {
+	std::string title = "Caustics Image";
+	for (const ProfileEntry& entry : Profiler::LastFrame()) {
+		char text[64];
+		if (entry.counter) { std::snprintf(text, sizeof(text), " | %s %.0f", entry.name, entry.value); }
+		else { std::snprintf(text, sizeof(text), " | %s %.2fms", entry.name, entry.value); }
+		title += text;
+	}
+	return title;
+}
+#endif
+
+template <typename T>
+void RenderFrame(std::span<const T> intersectionsX, std::span<const T> intersectionsY, const FrameRequest& request, Frame* frame, ThreadPool* pool) {	//bins and tone maps one solve into frame, on the solver thread
+	float scaleX = request.width / 256.0f;		//initially, we draw to a 256x256 window, but we want to be able to account for changing the window size
+	float scaleY = request.height / 256.0f;
+
+	int channels = rayColors.empty() ? 1 : 3;
+	if (histogram.Width() != request.width || histogram.Height() != request.height || histogram.Channels() != channels) { histogram.Resize(request.width, request.height, channels); }
+
+	Splat<T>(&histogram, intersectionsX, intersectionsY, request.receiverPlane, scaleX, scaleY, pool);	//bin every ray into its pixel, brighter means more light landed there
+	frame->argb.resize(size_t(request.width) * request.height);
+	histogram.ToneMap(frame->argb.data(), request.width, pool);
+}
+
+template <typename T>
+struct FrameRenderer {	//the solver thread's side of the window, turns requests into frames from a cache of rays stored as T
+	const IntersectionCache<T>* cache;
+	ThreadPool* pool;
+	bool progressive;	//previews only work when every ray gets binned on its own, triangles and colours need all of them
+	RayArray<T> intersectionsX, intersectionsY;	//x,y positions on the receiver plane where light intersects, scaled up to match the 256x256 of the target image
+	RayArray<T> previewX, previewY;
+	bool solved = false;
+	double solvedPlane = 0;
+
+	FrameRenderer(const IntersectionCache<T>* cache, ThreadPool* pool, bool progressive) : cache(cache), pool(pool), progressive(progressive) {}
 
-	SDL_SetRenderDrawColor(renderer, 0xFF, 0xFF, 0xFF, 0xFF);	//then draw the intersections
-	for (int i = 0; i < numPoints; i++) {	
-		SDL_RenderDrawPointF(renderer, intersections[i].x() * scaleX, intersections[i].y() * scaleY);	//scaling up the image to match the window size
+	void operator()(const FrameRequest& request, SolverThread* solver) {
+		auto publish = [&] {
+			solver->Publish();
+#ifdef CAUSTICS_PROFILE
+			Profiler::EndFrame();
+#endif
+		};
+		bool moved = samplesPerSide == 0 && (!solved || request.receiverPlane != solvedPlane);	//a resize or redraw at the same distance only re-bins
+		if (moved && progressive) {
+			for (size_t stride : { 64, 16 }) {	//a 1/64 and then a 1/16 density frame right away, each a fraction of the work, the full one follows unless a newer distance overtakes it
+				size_t count = (cache->Size() + stride - 1) / stride;
+				if (count < 16384 || solver->Superseded()) { continue; }	//small meshes solve in full quickly enough
+				{
+					PROFILE_SCOPE("frame");
+					previewX.resize(count);
+					previewY.resize(count);
+					IntersectPreview<T>(*cache, stride, previewX, previewY, T(request.receiverPlane), pool);
+					RenderFrame<T>(previewX, previewY, request, solver->Back(), pool);	//the tone map keys on the average lit pixel, so fewer rays come out just as bright
+				}
+				publish();
+			}
+		}
+		{
+			PROFILE_SCOPE("frame");
+			if (moved) {
+				PROFILE_SCOPE("intersect");
+				size_t block = size_t(1) << 20;	//a few milliseconds of rays, checked in between so a stale distance gets dropped halfway instead of finished
+				solved = false;	//until the last block, a cancelled solve leaves the intersections half at the old distance
+				intersectionsX.resize(cache->Size());
+				intersectionsY.resize(cache->Size());
+				for (size_t begin = 0; begin < cache->Size(); begin += block) {
+					if (solver->Superseded()) { return; }
+					size_t count = std::min(block, cache->Size() - begin);
+					pool->ParallelFor(count, [&](size_t first, size_t last) {
+						IntersectRays<T>(*cache, begin + first, std::span<T>(intersectionsX).subspan(begin + first, last - first), std::span<T>(intersectionsY).subspan(begin + first, last - first), T(request.receiverPlane));
+					});
+				}
+				solved = true;
+				solvedPlane = request.receiverPlane;
+			}
+			if (solver->Superseded()) { return; }
+			RenderFrame<T>(intersectionsX, intersectionsY, request, solver->Back(), pool);
+		}
+		publish();
+		if (exportRequested.exchange(false)) {	//after the publish so the frame is on screen first, the histogram stays the solver thread's until the next request
+			std::string name = OutputName(exportPrefix, request.receiverPlane);
+			if (!ExportAsync(exportWriter, name, histogram, std::span<const T>(intersectionsX), std::span<const T>(intersectionsY), exportOptions, false, pool)) { std::cout << "Still busy writing earlier exports, skipped " << name << "\n"; }
+		}
+	}
+};
+
+void PresentFrame(SDL_Renderer* renderer, const Frame& frame) {	//display a finished frame onto the window, on the UI thread
+	PROFILE_SCOPE("present");
+	int width = frame.request.width;
+	int height = frame.request.height;
+	if (texture == nullptr || textureWidth != width || textureHeight != height) {
+		if (texture != nullptr) { SDL_DestroyTexture(texture); }
+		texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, width, height);
+		textureWidth = width;
+		textureHeight = height;
 	}
+
+	void* pixels = nullptr;
+	int pitch = 0;
+	if (SDL_LockTexture(texture, nullptr, &pixels, &pitch) == 0) {	//one upload for the whole frame instead of a draw call per point
+		for (int y = 0; y < height; y++) { std::memcpy(static_cast<char*>(pixels) + size_t(y) * pitch, frame.argb.data() + size_t(y) * width, size_t(width) * 4); }
+		SDL_UnlockTexture(texture);
+	}
+
+	SDL_SetRenderDrawColor(renderer, 0x00, 0x00, 0x00, 0xFF);
+	SDL_RenderClear(renderer);
+	SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+#ifdef CAUSTICS_PROFILE
+	if (profileOverlay) { DrawProfileBars(renderer); }
+#endif
 	SDL_RenderPresent(renderer);
+}
+
+bool ParseLight(const std::string& spec, Light* light) {	//"z" for the default beam along +z, "dir:x,y,z" for a tilted beam travelling along x,y,z, "point:x,y,z" for a point light at x,y,z
+	if (spec == "z") { *light = Light(); return true; }
+	size_t colon = spec.find(':');
+	if (colon == std::string::npos) { return false; }
+	std::string kind = spec.substr(0, colon);
+	Eigen::Vector3d value;
+	size_t begin = colon + 1;
+	for (int k = 0; k < 3; k++) {
+		size_t end = k < 2 ? spec.find(',', begin) : spec.size();
+		if (end == std::string::npos || end == begin) { return false; }
+		value[k] = std::stod(spec.substr(begin, end - begin));
+		begin = end + 1;
+	}
+	if (kind == "dir" && value.norm() > 0) { light->kind = Light::collimated; light->direction = value.normalized(); return true; }
+	if (kind == "point") { light->kind = Light::point; light->position = value; return true; }
+	return false;
+}
+
+bool ParseDispersion(const std::string& spec, Dispersion* dispersion) {	//"silica", "bk7", or "cauchy:A,B" with B in square micrometres
+	if (spec == "silica") { *dispersion = Dispersion::FusedSilica(); return true; }
+	if (spec == "bk7") { *dispersion = Dispersion::BK7(); return true; }
+	size_t comma = spec.find(',');
+	if (spec.rfind("cauchy:", 0) != 0 || comma == std::string::npos) { return false; }
+	*dispersion = Dispersion::Cauchy(std::stod(spec.substr(7, comma - 7)), std::stod(spec.substr(comma + 1)));
+	return true;
+}
+
+bool LoadExitSurface(const std::string& objPath, bool useMeshCache, MeshCache* meshCache, RayBuffer<double>* surface, double relief, ThreadPool* pool) {	//the second surface only gets hit through its triangles, so it always needs its faces
+	Heightfield field;
+	if (IsHeightfieldPath(objPath)) {
+		if (!ReadHeightfield(objPath, relief, &field)) { return false; }
+		HeightfieldMesh(field, surface, pool);
+	}
+	else if (useMeshCache && meshCache->Open(objPath, true)) { meshCache->View(surface); }
+	else {
+		std::vector<Eigen::Vector3d> vertices;
+		std::vector<Eigen::Vector3d> normals;
+		std::vector<uint32_t> normalIndex;
+		std::vector<uint32_t> faces;
+		ParseOBJ(objPath, &vertices, &normals, &normalIndex, &faces, pool);
+		if (normalIndex.empty() && normals.size() != vertices.size()) {	//the triangles' own flat normals get used instead
+			std::cout << objPath << " has " << normals.size() << " normals for " << vertices.size() << " vertices, shading it flat\n";
+			normals.assign(vertices.size(), Eigen::Vector3d::Zero());
+		}
+		FillRayBuffer(vertices, normals, std::move(normalIndex), std::move(faces), surface, pool);
+		if (useMeshCache) { MeshCache::Write(objPath, *surface, true); }
+	}
+	if (surface->triangles.empty()) { std::cout << objPath << " has no faces to trace through\n"; return false; }
+	return true;
+}
+
+template <typename T>
+int WriteCaustics(const IntersectionCache<T>& cache, std::span<const double> distances, const std::string& prefix, int width, int height, ThreadPool* pool) {	//headless batch, the exportOptions files per distance, written while the next distance solves
+	AsyncWriter writer(2);	//one distance written while the next solves, a snapshot each is all that's held in memory
+	RayArray<T> intersectionsX(cache.Size());
+	RayArray<T> intersectionsY(cache.Size());
+	Histogram image;
+	image.Resize(width, height, rayColors.empty() ? 1 : 3);
+
+	for (double distance : distances) {
+		std::string name = OutputName(prefix, distance);
+		IntersectRays<T>(cache, intersectionsX, intersectionsY, T(distance), pool);
+		Splat<T>(&image, intersectionsX, intersectionsY, distance, width / 256.0f, height / 256.0f, pool);	//same mapping as the window
+		ExportAsync(&writer, name, image, std::span<const T>(intersectionsX), std::span<const T>(intersectionsY), exportOptions, true, pool);
+	}
+	return writer.Flush() ? 0 : 1;
+}
 
+int StreamBatch(const std::string& objPath, bool useMeshCache, bool useFaces, std::span<const Light> lights, std::span<const double> distances, size_t chunkSize, const std::string& prefix, int width, int height, ThreadPool* pool) {	//headless batch for lenses too big to load, every distance gets binned as the chunks go by
+	std::vector<Histogram> images(distances.size());
+	for (Histogram& image : images) { image.Resize(width, height); }
+	if (StreamCaustics(objPath, useMeshCache, useFaces, lights, distances, eta, chunkSize, images, pool) == 0) { return 1; }
+	AsyncWriter writer;
+	for (size_t k = 0; k < distances.size(); k++) { ExportAsync(&writer, OutputName(prefix, distances[k]), images[k], std::span<const double>(), std::span<const double>(), exportOptions, true, pool); }
+	return writer.Flush() ? 0 : 1;
 }
 
 int main(int argc, char** argv) {
+	if (argc >= 2 && std::string(argv[1]) == "--jobs") { return RunJobs(argc - 2, argv + 2); }		//many lenses from a job file, no window
+	if (argc >= 2 && std::string(argv[1]) == "--design") { return RunDesign(argc - 2, argv + 2); }	//shapes a heightfield lens after a target image, no window
 	
-	std::vector<Eigen::Vector3d> vertices;			//points, these are the positions where we refract rays through the lens
-	std::vector<Eigen::Vector3d> normals;			//normal vectors, these are used to calculate the refraction through the above points
-	std::vector<Eigen::Vector3d> refracteds;		//refracted ray vectors, these are the normalized directions that light leaves from each of the points
-	std::vector<Eigen::Vector2d> intersections;		//x,y positions on the receiver plane where light intersects, scaled up to match the 256x256 of the target image
+	MeshCache meshCache;							//memory mapped binary copy of the obj, declared first because the rays can point straight into it
+	RayBuffer<double> rays;							//points, normals and refracted ray directions, the positions where we refract rays through the lens and the normalized directions light leaves them in
+	IntersectionCache<double> cache;				//per-ray base points and slopes, moving the receiver plane only has to evaluate base + slope * distance
+	IntersectionCache<float> cacheFloat;			//the same with --precision float, the double one gets dropped once this is filled
+
+	int numThreads = 1;								//optional arguments after the first two, --threads N splits the ray loops across N threads, 0 uses all of them
+	bool useGpu = false;							//--gpu moves the rays onto the graphics card and solves there with compute shaders
+	std::string focusTarget;						//--focus target.png searches for the wall distance that best reproduces the target image, prints it and exits without opening a window
+	double focusNearest = -1, focusFarthest = -1;	//--range near far limits the search, by default it looks from half to twice the given distance
+	double focusTolerance = 0.001;					//--tolerance t, how finely the search pins down the distance
+	std::string outputPrefix;						//--output prefix solves every given distance without a window, writing prefix_<distance>.png for each, then exits
+													//--raw also writes the intersections of each distance to prefix_<distance>.bin, float32 x,y pairs, --delta the same delta compressed to .dlt
+													//--exr the linear counts to .exr next to the tone mapped .png, with or without --output
+													//--export prefix is where e in the window exports the current frame to, caustics_<distance> by default
+	int imageWidth = 256, imageHeight = 256;		//--size W H of the written images
+	bool useMeshCache = true;						//--no-cache always parses the obj text and leaves the binary sidecar alone
+	bool useFaces = false;							//--faces pairs vertices with normals through the f records instead of by position, for exporters that share or reorder normals
+	std::vector<Light> lights;						//--light spec, repeatable, every light goes through the same pass over the mesh and adds its caustics on top, one beam along +z when none are given
+	bool useTriangles = false;						//--triangles (implies --faces) rasterizes every triangle's flux onto the wall, smooth caustics from a much coarser mesh, CPU only
+	size_t streamChunk = 0;							//--stream N, with --output, reads and solves the mesh N rays at a time instead of loading all of it, for lenses bigger than memory
+	int numWavelengths = 0;							//--spectral K traces K wavelengths across the visible range through the dispersion of the lens material and renders in colour
+	Dispersion dispersion;							//--dispersion silica|bk7|cauchy:A,B, the material for --spectral, fused silica by default
+	double relief = 1;								//--relief h, for a heightfield instead of an obj (.png or .f32 as the first argument or --exit), the height of a white pixel or the scale of the float heights
+	bool sortRays = false;							//--sort reorders the rays along a Morton curve once after loading, so the binning writes stay local, --raw dumps come out in that order
+	bool useFloat = false;							//--precision float|double, what every re-solve reads its rays from and writes the intersections to, float halves the bytes per ray, the rays are still refracted in double
+	std::string tracePath;							//--trace out.json writes every timed stage as a Chrome trace on exit, only in builds with -DCAUSTICS_PROFILE
+	std::string exitPath;							//--exit surface.obj traces through a second, curved surface, the first obj is then where light enters the glass and this one where it leaves
+	for (int i = 3; i < argc; i++) {
+		std::string arg = argv[i];
+		if ((arg == "--threads" || arg == "-t") && i + 1 < argc) { numThreads = std::stoi(argv[++i]); }
+		else if (arg == "--gpu") { useGpu = true; }
+		else if (arg == "--focus" && i + 1 < argc) { focusTarget = argv[++i]; }
+		else if (arg == "--range" && i + 2 < argc) { focusNearest = std::stod(argv[i + 1]); focusFarthest = std::stod(argv[i + 2]); i += 2; }
+		else if (arg == "--tolerance" && i + 1 < argc) { focusTolerance = std::stod(argv[++i]); }
+		else if (arg == "--output" && i + 1 < argc) { outputPrefix = argv[++i]; }
+		else if (arg == "--raw") { exportOptions.raw = true; }
+		else if (arg == "--delta") { exportOptions.delta = true; }
+		else if (arg == "--exr") { exportOptions.exr = true; }
+		else if (arg == "--export" && i + 1 < argc) { exportPrefix = argv[++i]; }
+		else if (arg == "--no-cache") { useMeshCache = false; }
+		else if (arg == "--faces") { useFaces = true; }
+		else if (arg == "--triangles") { useTriangles = useFaces = true; }
+		else if (arg == "--light" && i + 1 < argc) {
+			Light light;
+			if (ParseLight(argv[++i], &light)) { lights.push_back(light); }
+			else { std::cout << "Couldn't read light " << argv[i] << ", expected z, dir:x,y,z or point:x,y,z\n"; }
+		}
+		else if (arg == "--samples" && i + 1 < argc) { samplesPerSide = std::stoi(argv[++i]); useTriangles = useFaces = samplesPerSide > 0; }
+		else if (arg == "--relief" && i + 1 < argc) { relief = std::stod(argv[++i]); }
+		else if (arg == "--exit" && i + 1 < argc) { exitPath = argv[++i]; }
+		else if (arg == "--trace" && i + 1 < argc) { tracePath = argv[++i]; }
+		else if (arg == "--sort") { sortRays = true; }
+		else if (arg == "--precision" && i + 1 < argc) {
+			std::string precision = argv[++i];
+			if (precision == "float" || precision == "double") { useFloat = precision == "float"; }
+			else { std::cout << "Unknown precision " << precision << ", expected float or double\n"; }
+		}
+		else if (arg == "--spectral" && i + 1 < argc) { numWavelengths = std::stoi(argv[++i]); }
+		else if (arg == "--dispersion" && i + 1 < argc) {
+			if (!ParseDispersion(argv[++i], &dispersion)) { std::cout << "Couldn't read dispersion " << argv[i] << ", expected silica, bk7 or cauchy:A,B\n"; }
+		}
+		else if (arg == "--stream" && i + 1 < argc) { streamChunk = std::stoull(argv[++i]); }
+		else if (arg == "--size" && i + 2 < argc) { imageWidth = std::stoi(argv[i + 1]); imageHeight = std::stoi(argv[i + 2]); i += 2; }
+		else { std::cout << "Unknown argument " << arg << "\n"; }
+	}
+#ifdef CAUSTICS_PROFILE
+	struct TraceOnExit {							//written on every way out of main, the headless modes return early
+		std::string path;
+		~TraceOnExit() {
+			if (path.empty()) { return; }
+			if (Profiler::WriteTrace(path)) { std::cout << "Wrote trace " << path << "\n"; }
+			else { std::cout << "Couldn't write trace " << path << "\n"; }
+		}
+	} traceOnExit{ tracePath };
+#else
+	if (!tracePath.empty()) { std::cout << "--trace needs a build with -DCAUSTICS_PROFILE, not writing " << tracePath << "\n"; }
+#endif
+	ThreadPool pool(numThreads);					//started once and reused by every solve
+	if (lights.empty()) { lights.push_back(Light()); }
+	bool defaultLight = lights.size() == 1 && lights[0].IsAlongZ();
+	bool heightfieldInput = IsHeightfieldPath(argv[1]);
+	if (streamChunk > 0 && heightfieldInput) { std::cout << "A heightfield is already 8 bytes a ray, --stream ignored\n"; streamChunk = 0; }
+	if (streamChunk > 0 && !exitPath.empty()) { std::cout << "--exit isn't streamed, ignored with --stream\n"; exitPath.clear(); }
+	if (numWavelengths > 0 && !exitPath.empty()) { std::cout << "--spectral only traces one surface, ignored with --exit\n"; numWavelengths = 0; }
+	if (numWavelengths > 0 && !defaultLight) { std::cout << "--spectral only traces the beam along +z, ignored with --light\n"; numWavelengths = 0; }
+	if (numWavelengths > 0 && streamChunk > 0) { std::cout << "--spectral isn't streamed, ignored with --stream\n"; numWavelengths = 0; }
+	if (numWavelengths > 0 && useTriangles) { std::cout << "--spectral bins one ray per vertex and wavelength, ignoring --triangles and --samples\n"; useTriangles = false; samplesPerSide = 0; }
+	Spectrum spectrum;
+	if (numWavelengths > 0) {
+		spectrum = MakeSpectrum(dispersion, numWavelengths, eta, SpectralLanes<double>());
+		rayColors = spectrum.colors;
+	}
+	Heightfield field;								//with a heightfield the plain solve never builds the mesh at all, the kernel works off the heights
+	MeshCache exitCache;
+	RayBuffer<double> exitSurface;
+	TriangleBVH exitBVH;
+	auto prepare = [&]() {							//the refracted ray directions at each point for every light or wavelength, straight into base points and slopes
+		if (field.Size() > 0) { PrepareIntersections(field, eta, &cache, &pool); }
+		else if (!exitPath.empty()) { PrepareIntersections(rays, lights, eta, exitSurface, exitBVH, &cache, &pool); }
+		else if (rayColors.empty()) { PrepareIntersections<double>(rays, lights, eta, &cache, &pool); }
+		else { PrepareSpectrum<double>(rays, spectrum.etas, &cache, &pool); }
+	};
+	auto narrow = [&]() {							//--precision float, moves the prepared cache over and frees the double one
+		ConvertCache(cache, &cacheFloat, &pool);
+		cache = {};
+	};
+
+	std::vector<double> distances = ParseDistances(argv[2]);	//second argument is the initial distance between the lens and the receiver plane/the wall, in the z direction, wall is parallel to x-y plane
+	if (distances.empty()) { std::cout << "No distance given\n"; return 1; }		//batch mode takes a comma separated list, the window starts at the first one
+	double receieverPlane = distances[0];
+
+	if (streamChunk > 0 && outputPrefix.empty()) { std::cout << "--stream only works together with --output\n"; }
+	if (streamChunk > 0 && !outputPrefix.empty()) {	//never holds the whole mesh, so this has to happen before loading it
+		if (exportOptions.raw || exportOptions.delta) { std::cout << "--raw and --delta need every intersection at once, ignored with --stream\n"; exportOptions.raw = exportOptions.delta = false; }
+		if (useTriangles) { std::cout << "Triangles can span chunks, --stream bins the vertices instead\n"; samplesPerSide = 0; }
+		if (sortRays) { std::cout << "--sort needs the whole mesh, ignored with --stream\n"; }
+		return StreamBatch(argv[1], useMeshCache, useFaces, lights, distances, streamChunk, outputPrefix, imageWidth, imageHeight, &pool);
+	}
 
-	ParseOBJ(argv[1], &vertices, &normals);			//first command line argument is the path to the obj file
-	double receieverPlane = std::stod(argv[2]);		//second argument is the initial distance between the lens and the receiver plane/the wall, in the z direction, wall is parallel to x-y plane
+	if (heightfieldInput) {
+		if (!ReadHeightfield(argv[1], relief, &field)) { return 1; }
+		if (useTriangles || !defaultLight || !rayColors.empty() || !exitPath.empty() || useGpu) {	//those need vertices and normals to work with
+			HeightfieldMesh(field, &rays, &pool);
+			field.heights = {};
+		}
+	}
+	else if (useMeshCache && meshCache.Open(argv[1], useFaces)) { meshCache.View(&rays); }	//first command line argument is the path to the obj file, loads instantly if it was parsed before
+	else {
+		std::vector<Eigen::Vector3d> vertices;
+		std::vector<Eigen::Vector3d> normals;
+		std::vector<uint32_t> normalIndex;
+		std::vector<uint32_t> faces;
+		ParseOBJ(argv[1], &vertices, &normals, useFaces ? &normalIndex : nullptr, useFaces ? &faces : nullptr, &pool);
+		if (normalIndex.empty() && normals.size() != vertices.size()) {	//positional pairing needs one normal per vertex
+			std::cout << vertices.size() << " vertices but " << normals.size() << " normals, only pairing up the first ones (--faces takes the pairing from the f records)\n";
+			vertices.resize(std::min(vertices.size(), normals.size()));
+			normals.resize(vertices.size());
+			faces.clear();
+		}
+		FillRayBuffer(vertices, normals, std::move(normalIndex), std::move(faces), &rays, &pool);	//the kernels work on the structure of arrays copy, the parsed vectors go away at the end of this block
+		if (useMeshCache) { MeshCache::Write(argv[1], rays, useFaces); }
+	}
+	if (sortRays && field.Size() > 0) { std::cout << "The heightfield rows are already in spatial order, --sort ignored\n"; }
+	else if (sortRays) { SortRaysSpatially(&rays, &pool); }
+	if (!exitPath.empty()) {
+		if (!LoadExitSurface(exitPath, useMeshCache, &exitCache, &exitSurface, relief, &pool)) { return 1; }
+		exitBVH.Build(exitSurface);
+	}
+	if (samplesPerSide > 0 && !exitPath.empty()) { std::cout << "--samples only traces one surface, rasterizing the triangles instead\n"; samplesPerSide = 0; }
+	if (useTriangles && rays.triangles.empty()) { std::cout << "The obj has no faces, binning the vertices instead\n"; samplesPerSide = 0; }
+	if (samplesPerSide > 0 && !defaultLight) { std::cout << "--samples only traces the beam along +z, rasterizing the triangles instead\n"; samplesPerSide = 0; }
+	if (useTriangles) {								//also what the --samples fallbacks above end up with
+		triangles = rays.triangles;
+		triangleFlux.resize(triangles.size() / 3);
+		TriangleFlux<double>(rays, triangleFlux, &pool);
+		sampledRays = &rays;
+	}
+	if (useFloat && !triangleFlux.empty()) { std::cout << "--precision float only bins vertices, using double for --triangles\n"; useFloat = false; }
+	if (!focusTarget.empty()) {						//headless focus search, no SDL at all
+		int targetWidth = 0, targetHeight = 0;
+		std::vector<float> target;
+		if (!ReadPNG(focusTarget, &targetWidth, &targetHeight, &target)) { return 1; }
+		prepare();
+		if (focusNearest < 0) { focusNearest = receieverPlane / 2; focusFarthest = receieverPlane * 2; }
+		FocusResult focus = FindFocus(cache, target, targetWidth, targetHeight, focusNearest, focusFarthest, focusTolerance, &pool);
+		std::cout << "Best distance between wall and lens: " << focus.distance << " (similarity " << focus.similarity << ")\n";
+		return 0;
+	}
 
-	Refract(normals, &refracteds, eta);				//find the refracted ray directions at each point
+	if (!outputPrefix.empty()) {					//headless batch, no SDL either
+		prepare();
+		if (useFloat) { narrow(); return WriteCaustics(cacheFloat, distances, outputPrefix, imageWidth, imageHeight, &pool); }
+		return WriteCaustics(cache, distances, outputPrefix, imageWidth, imageHeight, &pool);
+	}
 
 	//make a window to display an image of the computed caustics
 	SDL_Init(SDL_INIT_EVERYTHING);
-	SDL_Window* window = SDL_CreateWindow("Caustics Image", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, windowWidth, windowHeight, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
-	SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+	SDL_Window* window = SDL_CreateWindow("Caustics Image", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, windowWidth, windowHeight, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE | (useGpu ? SDL_WINDOW_OPENGL : 0));
+	SDL_Renderer* renderer = nullptr;
 
-	CalculateIntersections(vertices, refracteds, &intersections, receieverPlane);
-	DrawIntersections(renderer, intersections);
+	GpuSolver gpu;
+	if (useGpu && !triangleFlux.empty()) { std::cout << "The GPU solver only bins vertices, using the CPU for --triangles\n"; useGpu = false; }
+	if (useGpu && !defaultLight) { std::cout << "The GPU solver only has the beam along +z, using the CPU for --light\n"; useGpu = false; }
+	if (useGpu && !exitPath.empty()) { std::cout << "The GPU solver only has one surface, using the CPU for --exit\n"; useGpu = false; }
+	if (useGpu && !rayColors.empty()) { std::cout << "The GPU solver only has one wavelength, using the CPU for --spectral\n"; useGpu = false; }
+	if (useGpu && gpu.Init(window)) {
+		gpu.Upload(rays);							//from here on the rays live on the device
+		gpu.Refract(eta);
+	}
+	else {
+		if (useGpu) { std::cout << "Falling back to the CPU solver\n"; }
+		useGpu = false;
+		renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+		prepare();
+		if (useFloat) { narrow(); }
+	}
+
+	AsyncWriter writer(4);							//a few exports can queue up behind a slow disk, e past that gets skipped with a message instead of stalling a frame
+	exportWriter = &writer;
+	std::unique_ptr<SolverThread> solver;			//CPU only, the GPU solves and presents on the UI thread because that's where its GL context lives
+	if (!useGpu) {
+		Uint32 frameReady = SDL_RegisterEvents(1);	//pushed by the solver thread after every frame so the event loop wakes up for it
+		bool progressive = rayColors.empty() && triangleFlux.empty() && samplesPerSide == 0;
+		std::function<void(const FrameRequest&, SolverThread*)> render;
+		if (useFloat) { render = FrameRenderer<float>(&cacheFloat, &pool, progressive); }
+		else { render = FrameRenderer<double>(&cache, &pool, progressive); }
+		auto ready = [frameReady] {
+			if (frameReady == Uint32(-1)) { return; }	//out of event types, the wait timeout picks the frame up instead
+			SDL_Event event = {};
+			event.type = frameReady;
+			SDL_PushEvent(&event);
+		};
+		solver = std::make_unique<SolverThread>(render, ready);
+	}
+
+	auto show = [&]() {								//asks for the caustics at the current distance and window size
+		if (solver) { solver->Request({ receieverPlane, windowWidth, windowHeight }); return; }	//shows up once the solver thread is done with it
+		{
+			PROFILE_SCOPE("frame");
+			gpu.Draw(receieverPlane, windowWidth, windowHeight);	//the GPU always solves straight into the framebuffer it presents
+		}
+#ifdef CAUSTICS_PROFILE
+		Profiler::EndFrame();
+		if (profileOverlay) { SDL_SetWindowTitle(window, ProfileTitle().c_str()); }
+#endif
+	};
+	show();
 
 	bool quit = false;
 	SDL_Event e;
-	while (!quit) //main loop
+	while (!quit) //main loop, sleeps until there's an event instead of spinning
 	{
-		while (SDL_PollEvent(&e) != 0)	//loop through events
+		bool changed = false;
+		for (bool hasEvent = SDL_WaitEventTimeout(&e, 100) != 0; hasEvent; hasEvent = SDL_PollEvent(&e) != 0)	//wait for one event, then take everything else that queued up meanwhile, so held keys coalesce into one request for the latest distance
 		{
 			if (e.type == SDL_QUIT) { quit = true; }
-			else if (e.window.event == SDL_WINDOWEVENT_RESIZED) {
+			else if (e.type == SDL_WINDOWEVENT && e.window.event == SDL_WINDOWEVENT_RESIZED) {
 				windowWidth = e.window.data1;
 				windowHeight = e.window.data2;
-				DrawIntersections(renderer, intersections);
+				changed = true;
 			}
 			else if (e.type == SDL_KEYDOWN) {
 				switch (e.key.keysym.sym) {
 				case SDLK_w:	//for fine-tuning the position of the lens
 					receieverPlane += 0.1;
-					CalculateIntersections(vertices, refracteds, &intersections, receieverPlane);
-					DrawIntersections(renderer, intersections);
+					changed = true;
 					break;
 				case SDLK_s:	//for fine-tuning the position of the lens
 					receieverPlane -= 0.1;
-					CalculateIntersections(vertices, refracteds, &intersections, receieverPlane);
-					DrawIntersections(renderer, intersections);
+					changed = true;
 					break;
 				case SDLK_q:	//for fine-tuning the position of the lens
 					std::cout << "Current distance between wall and lens: " << receieverPlane << "\n";
 					break;
+				case SDLK_e:	//export the current distance, it goes through the solver thread so it picks up the finished full density frame rather than a preview
+					if (!solver) { std::cout << "Exporting needs the CPU solver, the GPU draws straight to the window\n"; break; }
+					exportRequested = true;
+					changed = true;
+					break;
+#ifdef CAUSTICS_PROFILE
+				case SDLK_p:	//stage timings of the last frame, the bars show up with the next frame
+					profileOverlay = !profileOverlay;
+					SDL_SetWindowTitle(window, profileOverlay ? ProfileTitle().c_str() : "Caustics Image");
+					changed = true;
+					break;
+#endif
 				case SDLK_ESCAPE:
 					quit = true;
 					break;
@@ -82,8 +552,15 @@ int main(int argc, char** argv) {
 				}
 			}
 		}
+		if (changed && !quit) { show(); }
 
-		
+		Frame* frame = solver ? solver->Latest() : nullptr;	//whatever finished last, frames that got overtaken while the loop was busy are never shown
+		if (frame != nullptr) {
+			PresentFrame(renderer, *frame);
+#ifdef CAUSTICS_PROFILE
+			if (profileOverlay) { SDL_SetWindowTitle(window, ProfileTitle().c_str()); }
+#endif
+		}
 	}
 
 	return 0;
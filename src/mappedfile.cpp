@@ -0,0 +1,73 @@
+#include "mappedfile.h"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+MappedFile::MappedFile(const std::string& path) {
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) { return; }
+	fileHandle = file;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize)) { return; }
+	size = size_t(fileSize.QuadPart);
+	isOpen = true;
+	if (size == 0) { return; }	//can't map an empty file, but it's still a valid (empty) file
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr) { isOpen = false; return; }
+	mappingHandle = mapping;
+	data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	if (data == nullptr) { isOpen = false; }
+}
+
+void MappedFile::Discard(size_t, size_t) {}	//windows trims the working set of a mapped view by itself
+
+MappedFile::~MappedFile() {
+	if (data != nullptr) { UnmapViewOfFile(data); }
+	if (mappingHandle != nullptr) { CloseHandle(mappingHandle); }
+	if (fileHandle != nullptr) { CloseHandle(fileHandle); }
+}
+#else
+MappedFile::MappedFile(const std::string& path) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) { return; }
+
+	struct stat st;
+	if (fstat(fd, &st) == 0) {
+		size = size_t(st.st_size);
+		isOpen = true;
+		if (size > 0) {
+			void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (mapping == MAP_FAILED) { isOpen = false; }
+			else {
+				data = static_cast<const char*>(mapping);
+				madvise(mapping, size, MADV_SEQUENTIAL);	//we only ever walk the file front to back
+			}
+		}
+	}
+	close(fd);	//the mapping keeps its own reference to the file
+}
+
+void MappedFile::Discard(size_t begin, size_t end) {
+	size_t pageSize = size_t(sysconf(_SC_PAGESIZE));
+	begin = (begin + pageSize - 1) / pageSize * pageSize;	//only pages that are completely inside, the ones at the edges may still be read
+	end = std::min(end, size) / pageSize * pageSize;
+	if (data != nullptr && end > begin) { madvise(const_cast<char*>(data) + begin, end - begin, MADV_DONTNEED); }	//read-only private mapping, a dropped page that does get read again is just faulted back in from the file
+}
+
+MappedFile::~MappedFile() {
+	if (data != nullptr) { munmap(const_cast<char*>(data), size); }
+}
+#endif
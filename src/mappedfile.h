@@ -0,0 +1,25 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+class MappedFile {	//read-only memory mapping of a whole file, so parsers can walk the bytes in place without copying them into strings
+public:
+	explicit MappedFile(const std::string& path);
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool IsOpen() const { return isOpen; }
+	const char* Data() const { return data; }
+	size_t Size() const { return size; }
+	void Discard(size_t begin, size_t end);	//hint that bytes [begin, end) won't be read again so their pages can leave memory, for streaming files way bigger than RAM
+
+private:
+	const char* data = nullptr;
+	size_t size = 0;
+	bool isOpen = false;
+#ifdef _WIN32
+	void* fileHandle = nullptr;
+	void* mappingHandle = nullptr;
+#endif
+};
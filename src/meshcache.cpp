@@ -0,0 +1,142 @@
+#include "meshcache.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <system_error>
+
+#include "profile.h"
+
+static_assert(sizeof(MeshCacheHeader) == 128, "the arrays after the header rely on it being whole cache lines");
+
+namespace {
+
+const char meshCacheMagic[8] = { 'C', 'A', 'U', 'S', 'T', 'M', 'S', 'H' };
+const uint32_t meshCacheVersion = 3;
+
+std::string CachePath(const std::string& objPath) { return objPath + ".cache"; }
+
+size_t Padded(size_t bytes) { return (bytes + 63) / 64 * 64; }	//bytes between the starts of two arrays
+
+bool SourceStamp(const std::string& objPath, uint64_t* size, int64_t* time) {
+	std::error_code error;
+	*size = std::filesystem::file_size(objPath, error);
+	if (error) { return false; }
+	*time = std::filesystem::last_write_time(objPath, error).time_since_epoch().count();
+	return !error;
+}
+
+uint64_t Checksum(const void* data, size_t bytes, uint64_t hash) {	//four independent multiply-xor lanes over 64 bit words, fast enough that verifying costs about as much as reading the pages in
+	const uint64_t prime = 0x100000001B3ull;
+	const char* p = static_cast<const char*>(data);
+	uint64_t lanes[4] = { hash, hash ^ 1, hash ^ 2, hash ^ 3 };
+	size_t numWords = bytes / 8, i = 0;
+	for (; i + 4 <= numWords; i += 4) {
+		for (int k = 0; k < 4; k++) {
+			uint64_t word;
+			std::memcpy(&word, p + 8 * (i + k), sizeof(word));
+			lanes[k] = (lanes[k] ^ word) * prime;
+		}
+	}
+	for (; i < numWords; i++) {
+		uint64_t word;
+		std::memcpy(&word, p + 8 * i, sizeof(word));
+		lanes[0] = (lanes[0] ^ word) * prime;
+	}
+	uint64_t tail = 0;
+	if (bytes % 8 != 0) { std::memcpy(&tail, p + 8 * numWords, bytes % 8); }
+	lanes[1] = (lanes[1] ^ tail) * prime;
+	return ((lanes[0] * prime ^ lanes[1]) * prime ^ lanes[2]) * prime ^ lanes[3];
+}
+
+struct Section {	//one array of the cache
+	const void* data;
+	size_t bytes;
+};
+
+}
+
+bool MeshCache::Open(const std::string& objPath, bool faces) {
+	PROFILE_SCOPE("mesh cache open");
+	file.reset();
+	numVertices = numNormals = numTriangles = 0;
+	uint64_t sourceSize = 0;
+	int64_t sourceTime = 0;
+	if (!SourceStamp(objPath, &sourceSize, &sourceTime)) { return false; }
+
+	auto mapped = std::make_unique<MappedFile>(CachePath(objPath));
+	if (!mapped->IsOpen() || mapped->Size() < sizeof(MeshCacheHeader)) { return false; }
+	MeshCacheHeader header;
+	std::memcpy(&header, mapped->Data(), sizeof(header));
+	if (std::memcmp(header.magic, meshCacheMagic, 8) != 0 || header.version != meshCacheVersion || header.scalarSize != sizeof(double)) { return false; }
+	if (header.sourceSize != sourceSize || header.sourceTime != sourceTime) { return false; }	//obj changed since the cache was written
+	if (((header.flags & meshCacheFaces) != 0) != faces) { return false; }	//same obj read the other way, the pairing may differ
+	bool hasIndex = (header.flags & meshCacheIndexed) != 0;
+	size_t vertexBytes = header.numVertices * sizeof(double), normalBytes = header.numNormals * sizeof(double), indexBytes = hasIndex ? header.numVertices * sizeof(uint32_t) : 0;
+	size_t triangleBytes = header.numTriangles * 3 * sizeof(uint32_t);
+	if (mapped->Size() != sizeof(MeshCacheHeader) + 3 * Padded(vertexBytes) + 3 * Padded(normalBytes) + Padded(indexBytes) + Padded(triangleBytes)) { return false; }
+	if (!hasIndex && header.numNormals != header.numVertices) { return false; }
+
+	uint64_t checksum = 0xCBF29CE484222325ull;
+	const char* p = mapped->Data() + sizeof(MeshCacheHeader);	//mappings are page aligned, so every array is 64 byte aligned
+	for (int k = 0; k < 3; k++) { checksum = Checksum(p, vertexBytes, checksum); p += Padded(vertexBytes); }
+	for (int k = 0; k < 3; k++) { checksum = Checksum(p, normalBytes, checksum); p += Padded(normalBytes); }
+	checksum = Checksum(p, indexBytes, checksum);
+	checksum = Checksum(p + Padded(indexBytes), triangleBytes, checksum);
+	if (checksum != header.checksum) { std::cout << "Ignoring corrupt mesh cache " << CachePath(objPath) << "\n"; return false; }
+
+	file = std::move(mapped);
+	numVertices = header.numVertices;
+	numNormals = header.numNormals;
+	numTriangles = header.numTriangles;
+	indexed = hasIndex;
+	return true;
+}
+
+void MeshCache::View(RayBuffer<double>* rays) const {
+	const char* p = file->Data() + sizeof(MeshCacheHeader);
+	size_t vertexStride = Padded(numVertices * sizeof(double)), normalStride = Padded(numNormals * sizeof(double));
+	auto vertex = [&](int k) { return std::span<const double>(reinterpret_cast<const double*>(p + k * vertexStride), numVertices); };
+	auto normal = [&](int k) { return std::span<const double>(reinterpret_cast<const double*>(p + 3 * vertexStride + k * normalStride), numNormals); };
+	const char* indexStart = p + 3 * vertexStride + 3 * normalStride;
+	std::span<const uint32_t> index;
+	if (indexed) { index = { reinterpret_cast<const uint32_t*>(indexStart), numVertices }; }
+	std::span<const uint32_t> triangles(reinterpret_cast<const uint32_t*>(indexStart + Padded(index.size_bytes())), 3 * numTriangles);
+	rays->View(vertex(0), vertex(1), vertex(2), normal(0), normal(1), normal(2), index, triangles);
+}
+
+bool MeshCache::Write(const std::string& objPath, const RayBuffer<double>& rays, bool faces) {
+	MeshCacheHeader header = {};
+	std::memcpy(header.magic, meshCacheMagic, 8);
+	header.version = meshCacheVersion;
+	header.scalarSize = sizeof(double);
+	header.numVertices = rays.Size();
+	header.numNormals = rays.NumNormals();
+	header.flags = (rays.normalIndex.empty() ? 0 : meshCacheIndexed) | (faces ? meshCacheFaces : 0);
+	header.numTriangles = rays.triangles.size() / 3;
+	if (!SourceStamp(objPath, &header.sourceSize, &header.sourceTime)) { return false; }
+	const Section sections[8] = { { rays.vx.data(), rays.vx.size_bytes() }, { rays.vy.data(), rays.vy.size_bytes() }, { rays.vz.data(), rays.vz.size_bytes() },
+		{ rays.nx.data(), rays.nx.size_bytes() }, { rays.ny.data(), rays.ny.size_bytes() }, { rays.nz.data(), rays.nz.size_bytes() }, { rays.normalIndex.data(), rays.normalIndex.size_bytes() },
+		{ rays.triangles.data(), rays.triangles.size_bytes() } };
+	header.checksum = 0xCBF29CE484222325ull;
+	for (const Section& section : sections) { header.checksum = Checksum(section.data, section.bytes, header.checksum); }
+
+	std::string path = CachePath(objPath);
+	std::string temporary = path + ".tmp";	//written to the side and renamed, so a crash never leaves a half written cache that looks valid
+	{
+		std::ofstream out(temporary, std::ios::binary);
+		if (!out.is_open()) { std::cout << "Couldn't write mesh cache " << path << "\n"; return false; }
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		const char padding[64] = {};
+		for (const Section& section : sections) {
+			out.write(static_cast<const char*>(section.data), std::streamsize(section.bytes));
+			out.write(padding, std::streamsize(Padded(section.bytes) - section.bytes));
+		}
+		if (!out) { std::cout << "Couldn't write mesh cache " << path << "\n"; return false; }
+	}
+	std::error_code error;
+	std::filesystem::rename(temporary, path, error);
+	if (error) { std::filesystem::remove(temporary, error); return false; }
+	return true;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include "mappedfile.h"
+#include "raybuffer.h"
+
+//binary sidecar next to an obj (lens.obj -> lens.obj.cache) so repeated launches skip the text parse
+//layout: a 128 byte header, the three vertex components and the three normal components as contiguous double arrays, then the uint32 normal index if the mesh has one
+//and the uint32 triangle corners if the faces were read, every array starting on a 64 byte boundary
+struct MeshCacheHeader {
+	char magic[8];			//"CAUSTMSH"
+	uint32_t version;
+	uint32_t scalarSize;	//bytes per stored component, 8 for double
+	uint64_t numVertices;
+	uint64_t sourceSize;	//size and modification time of the obj the cache was built from, a mismatch means it's stale
+	int64_t sourceTime;
+	uint64_t checksum;		//over all the arrays
+	uint64_t numNormals;
+	uint64_t flags;			//the bits below
+	uint64_t numTriangles;
+	uint64_t reserved[7];
+};
+
+const uint64_t meshCacheIndexed = 1;	//a per-vertex normal index follows the normals
+const uint64_t meshCacheFaces = 2;		//built from the f records rather than pairing v and vn by position
+
+class MeshCache {
+public:
+	bool Open(const std::string& objPath, bool faces = false);	//maps the sidecar of objPath, false if there is none or it doesn't match the obj (or how it was read) anymore
+	void View(RayBuffer<double>* rays) const;	//points the rays at the mapped arrays without copying, the cache has to stay open as long as the rays are used
+	size_t Size() const { return numVertices; }
+
+	static bool Write(const std::string& objPath, const RayBuffer<double>& rays, bool faces = false);	//writes the sidecar for objPath from freshly parsed rays
+
+private:
+	std::unique_ptr<MappedFile> file;
+	size_t numVertices = 0;
+	size_t numNormals = 0;
+	size_t numTriangles = 0;
+	bool indexed = false;
+};
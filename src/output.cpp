@@ -0,0 +1,147 @@
+#include "output.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include "exr.h"
+#include "png.h"
+
+std::vector<double> ParseDistances(const std::string& list) {
+	std::vector<double> distances;
+	size_t begin = 0;
+	while (begin <= list.size()) {
+		size_t end = std::min(list.find(',', begin), list.size());
+		if (end > begin) { distances.push_back(std::stod(list.substr(begin, end - begin))); }
+		begin = end + 1;
+	}
+	return distances;
+}
+
+std::string OutputName(const std::string& prefix, double distance) { return prefix + "_" + std::to_string(distance); }
+
+std::vector<unsigned char> ImageBytes(const Histogram& image, ThreadPool* pool) {
+	std::vector<uint32_t> argb(size_t(image.Width()) * size_t(image.Height()));
+	image.ToneMap(argb.data(), image.Width(), pool);
+	if (image.Channels() == 1) {
+		std::vector<unsigned char> gray(argb.size());
+		for (size_t i = 0; i < argb.size(); i++) { gray[i] = static_cast<unsigned char>(argb[i] & 0xFF); }	//the tone map is gray, any channel will do
+		return gray;
+	}
+	std::vector<unsigned char> rgb(argb.size() * 3);
+	for (size_t i = 0; i < argb.size(); i++) {
+		rgb[3 * i] = static_cast<unsigned char>(argb[i] >> 16);
+		rgb[3 * i + 1] = static_cast<unsigned char>(argb[i] >> 8);
+		rgb[3 * i + 2] = static_cast<unsigned char>(argb[i]);
+	}
+	return rgb;
+}
+
+bool WriteImage(const Histogram& image, const std::string& path, ThreadPool* pool) {
+	std::vector<unsigned char> pixels = ImageBytes(image, pool);
+	return WritePNG(path, image.Width(), image.Height(), pixels.data(), image.Channels() == 1 ? 1 : 3);
+}
+
+bool WriteLinearImage(const Histogram& image, const std::string& path) { return WriteEXR(path, image.Width(), image.Height(), image.Pixels().data(), image.Channels()); }
+
+template <typename T>
+static bool WriteInterleaved(const std::string& path, std::span<const T> intersectionsX, std::span<const T> intersectionsY) {
+	std::ofstream file(path, std::ios::binary);
+	if (!file.is_open()) { std::cout << "Couldn't write " << path << "\n"; return false; }
+
+	const size_t blockSize = 1 << 16;	//convert and write a block at a time instead of building the whole file in memory
+	std::vector<float> block(2 * blockSize);
+	for (size_t begin = 0; begin < intersectionsX.size(); begin += blockSize) {
+		size_t n = std::min(blockSize, intersectionsX.size() - begin);
+		for (size_t i = 0; i < n; i++) {
+			block[2 * i] = float(intersectionsX[begin + i]);
+			block[2 * i + 1] = float(intersectionsY[begin + i]);
+		}
+		file.write(reinterpret_cast<const char*>(block.data()), std::streamsize(2 * n * sizeof(float)));
+	}
+	return bool(file);
+}
+
+bool WriteIntersections(const std::string& path, std::span<const double> intersectionsX, std::span<const double> intersectionsY) { return WriteInterleaved(path, intersectionsX, intersectionsY); }
+bool WriteIntersections(const std::string& path, std::span<const float> intersectionsX, std::span<const float> intersectionsY) { return WriteInterleaved(path, intersectionsX, intersectionsY); }
+
+template <typename T>
+static bool WriteDeltas(const std::string& path, std::span<const T> intersectionsX, std::span<const T> intersectionsY) {
+	const uint32_t fractionBits = 12;	//1/4096 of a target pixel, well below what float intersections resolve at this scale anyway
+	const int64_t limit = int64_t(1) << 40;
+	auto fixed = [&](T value) {
+		if (std::isnan(value)) { return -limit; }
+		return std::clamp<int64_t>(std::llround(std::clamp(double(value), -double(limit), double(limit)) * double(1 << fractionBits)), -limit, limit);
+	};
+	std::vector<uint8_t> out;
+	out.reserve(24 + 4 * intersectionsX.size());
+	auto append = [&](const void* data, size_t size) { out.insert(out.end(), static_cast<const uint8_t*>(data), static_cast<const uint8_t*>(data) + size); };
+	uint32_t version = 1;
+	uint64_t count = intersectionsX.size();
+	append("CAUSTDLT", 8);
+	append(&version, 4);
+	append(&fractionBits, 4);
+	append(&count, 8);
+	auto varint = [&](int64_t delta) {
+		uint64_t zigzag = (uint64_t(delta) << 1) ^ uint64_t(delta >> 63);	//small magnitudes of either sign get small codes
+		while (zigzag >= 0x80) { out.push_back(uint8_t(zigzag | 0x80)); zigzag >>= 7; }
+		out.push_back(uint8_t(zigzag));
+	};
+	int64_t lastX = 0, lastY = 0;
+	for (size_t i = 0; i < intersectionsX.size(); i++) {
+		int64_t x = fixed(intersectionsX[i]), y = fixed(intersectionsY[i]);
+		varint(x - lastX);
+		varint(y - lastY);
+		lastX = x;
+		lastY = y;
+	}
+
+	std::ofstream file(path, std::ios::binary);
+	if (!file.is_open()) { std::cout << "Couldn't write " << path << "\n"; return false; }
+	file.write(reinterpret_cast<const char*>(out.data()), std::streamsize(out.size()));	//built in memory first so the disk sees one sequential write
+	return bool(file);
+}
+
+bool WriteIntersectionDeltas(const std::string& path, std::span<const double> intersectionsX, std::span<const double> intersectionsY) { return WriteDeltas(path, intersectionsX, intersectionsY); }
+bool WriteIntersectionDeltas(const std::string& path, std::span<const float> intersectionsX, std::span<const float> intersectionsY) { return WriteDeltas(path, intersectionsX, intersectionsY); }
+
+template <typename T>
+static bool Export(AsyncWriter* writer, const std::string& name, const Histogram& image, std::span<const T> intersectionsX, std::span<const T> intersectionsY, const ExportOptions& options, bool wait, ThreadPool* pool) {
+	struct Snapshot {
+		int width, height, channels;
+		std::vector<unsigned char> toneMapped;
+		std::vector<float> linear;
+		std::vector<T> x, y;
+	};
+	auto snapshot = std::make_shared<Snapshot>();	//the caller is free to re-solve into its buffers as soon as this returns
+	snapshot->width = image.Width();
+	snapshot->height = image.Height();
+	snapshot->channels = image.Channels();
+	if (options.png) { snapshot->toneMapped = ImageBytes(image, pool); }	//the tone map is parallel here, the writer thread only encodes
+	if (options.exr) { snapshot->linear.assign(image.Pixels().begin(), image.Pixels().end()); }
+	if (options.raw || options.delta) {
+		snapshot->x.assign(intersectionsX.begin(), intersectionsX.end());
+		snapshot->y.assign(intersectionsY.begin(), intersectionsY.end());
+	}
+
+	auto write = [snapshot, name, options] {
+		const Snapshot& s = *snapshot;
+		bool ok = true;
+		if (options.png) { ok = WritePNG(name + ".png", s.width, s.height, s.toneMapped.data(), s.channels == 1 ? 1 : 3) && ok; }
+		if (options.exr) { ok = WriteEXR(name + ".exr", s.width, s.height, s.linear.data(), s.channels) && ok; }
+		if (options.raw) { ok = WriteIntersections(name + ".bin", std::span<const T>(s.x), std::span<const T>(s.y)) && ok; }
+		if (options.delta) { ok = WriteIntersectionDeltas(name + ".dlt", std::span<const T>(s.x), std::span<const T>(s.y)) && ok; }
+		std::cout << (ok ? "Wrote " : "Couldn't write all of ") << name << "\n";
+		return ok;
+	};
+	if (!wait) { return writer->TrySubmit(write); }
+	writer->Submit(write);
+	return true;
+}
+
+bool ExportAsync(AsyncWriter* writer, const std::string& name, const Histogram& image, std::span<const double> intersectionsX, std::span<const double> intersectionsY, const ExportOptions& options, bool wait, ThreadPool* pool) { return Export(writer, name, image, intersectionsX, intersectionsY, options, wait, pool); }
+bool ExportAsync(AsyncWriter* writer, const std::string& name, const Histogram& image, std::span<const float> intersectionsX, std::span<const float> intersectionsY, const ExportOptions& options, bool wait, ThreadPool* pool) { return Export(writer, name, image, intersectionsX, intersectionsY, options, wait, pool); }
@@ -0,0 +1,36 @@
+#pragma once
+#include <span>
+#include <string>
+#include <vector>
+#include "histogram.h"
+#include "threadpool.h"
+#include "writer.h"
+
+std::vector<double> ParseDistances(const std::string& list);	//comma separated wall distances, "2.5,3,3.5"
+std::string OutputName(const std::string& prefix, double distance);	//prefix_<distance>, the extension gets added by the caller
+
+std::vector<unsigned char> ImageBytes(const Histogram& image, ThreadPool* pool = nullptr);	//same tone curve as the window, 8 bit gray for one channel or RGB for three, image.Channels() bytes a pixel
+bool WriteImage(const Histogram& image, const std::string& path, ThreadPool* pool = nullptr);	//the same as a PNG
+bool WriteLinearImage(const Histogram& image, const std::string& path);	//the counts themselves before any tone curve, as a float EXR
+
+//raw intersection dump, numRays (x, y) pairs of little endian float32 target image coordinates, interleaved, in vertex order, light after light
+bool WriteIntersections(const std::string& path, std::span<const double> intersectionsX, std::span<const double> intersectionsY);
+bool WriteIntersections(const std::string& path, std::span<const float> intersectionsX, std::span<const float> intersectionsY);
+
+//the same intersections delta compressed, usually 3-5 bytes a ray instead of 8, neighbouring rays land close together and more so after --sort
+//"CAUSTDLT", uint32 version 1, uint32 fraction bits f, uint64 numRays, then per ray the change in x and then in y from the ray before as zigzag LEB128 varints
+//of coordinates in fixed point with f fraction bits, starting from (0, 0), rays that went nowhere (NaN) are stored far off screen at -2^40
+bool WriteIntersectionDeltas(const std::string& path, std::span<const double> intersectionsX, std::span<const double> intersectionsY);
+bool WriteIntersectionDeltas(const std::string& path, std::span<const float> intersectionsX, std::span<const float> intersectionsY);
+
+struct ExportOptions {	//which files one export writes, all named prefix_<distance> plus the extension
+	bool png = true;	//tone mapped like the window
+	bool exr = false;	//linear counts
+	bool raw = false;	//.bin float32 intersections
+	bool delta = false;	//.dlt delta compressed intersections
+};
+
+//copies the image and the intersections it needs on the calling thread, then encodes and writes them on writer, so the caller can go on with the next solve straight away
+//wait false never blocks, returning false with nothing queued when the writer is already full, for the window
+bool ExportAsync(AsyncWriter* writer, const std::string& name, const Histogram& image, std::span<const double> intersectionsX, std::span<const double> intersectionsY, const ExportOptions& options, bool wait = true, ThreadPool* pool = nullptr);
+bool ExportAsync(AsyncWriter* writer, const std::string& name, const Histogram& image, std::span<const float> intersectionsX, std::span<const float> intersectionsY, const ExportOptions& options, bool wait = true, ThreadPool* pool = nullptr);
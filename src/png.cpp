@@ -0,0 +1,516 @@
+#include "png.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <queue>
+#include <utility>
+#include <vector>
+#include "mappedfile.h"
+
+namespace {
+
+struct BitReader {	//deflate packs its codes least significant bit first
+	const uint8_t* data;
+	size_t size;
+	size_t pos = 0;
+	uint32_t bitBuffer = 0;
+	int bitCount = 0;
+	bool overrun = false;
+
+	int Bits(int n) {
+		while (bitCount < n) {
+			if (pos >= size) { overrun = true; return 0; }
+			bitBuffer |= uint32_t(data[pos++]) << bitCount;
+			bitCount += 8;
+		}
+		int value = int(bitBuffer & ((1u << n) - 1));
+		bitBuffer >>= n;
+		bitCount -= n;
+		return value;
+	}
+};
+
+struct Huffman {	//canonical huffman code, stored as the number of codes of each length and the symbols in code order
+	uint16_t counts[16];
+	uint16_t symbols[320];
+};
+
+void BuildHuffman(Huffman* h, const uint8_t* lengths, int n) {
+	std::memset(h->counts, 0, sizeof(h->counts));
+	for (int i = 0; i < n; i++) { h->counts[lengths[i]]++; }
+	h->counts[0] = 0;
+	uint16_t offsets[16] = {};
+	for (int len = 1; len < 15; len++) { offsets[len + 1] = uint16_t(offsets[len] + h->counts[len]); }
+	for (int i = 0; i < n; i++) {
+		if (lengths[i] != 0) { h->symbols[offsets[lengths[i]]++] = uint16_t(i); }
+	}
+}
+
+int Decode(BitReader* in, const Huffman& h) {
+	int code = 0, first = 0, index = 0;
+	for (int len = 1; len < 16; len++) {
+		code |= in->Bits(1);
+		int count = h.counts[len];
+		if (code - first < count) { return h.symbols[index + code - first]; }
+		index += count;
+		first = (first + count) << 1;
+		code <<= 1;
+	}
+	return -1;
+}
+
+const uint16_t lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+const uint8_t lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+const uint16_t distanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+const uint8_t distanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+const uint8_t codeLengthOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };	//the order a dynamic block stores the code length code in
+
+bool InflateBlock(BitReader* in, const Huffman& lengths, const Huffman& distances, std::vector<uint8_t>* out) {
+	while (true) {
+		int symbol = Decode(in, lengths);
+		if (symbol < 0 || in->overrun) { return false; }
+		if (symbol < 256) { out->push_back(uint8_t(symbol)); continue; }
+		if (symbol == 256) { return true; }
+
+		symbol -= 257;
+		if (symbol >= 29) { return false; }
+		size_t length = lengthBase[symbol] + size_t(in->Bits(lengthExtra[symbol]));
+		int distanceSymbol = Decode(in, distances);
+		if (distanceSymbol < 0 || distanceSymbol >= 30) { return false; }
+		size_t distance = distanceBase[distanceSymbol] + size_t(in->Bits(distanceExtra[distanceSymbol]));
+		if (distance > out->size()) { return false; }
+		size_t from = out->size() - distance;
+		for (size_t k = 0; k < length; k++) { out->push_back((*out)[from + k]); }	//byte at a time, matches are allowed to overlap what they're producing
+	}
+}
+
+bool Inflate(const uint8_t* data, size_t size, std::vector<uint8_t>* out) {	//zlib stream, the 2 byte header is skipped and the adler checksum isn't checked
+	if (size < 2) { return false; }
+	BitReader in{ data + 2, size - 2 };
+
+	int last = 0;
+	while (!last) {
+		last = in.Bits(1);
+		int type = in.Bits(2);
+		if (type == 0) {	//stored block, starts on the next byte boundary
+			in.bitBuffer = 0;
+			in.bitCount = 0;
+			if (in.pos + 4 > in.size) { return false; }
+			size_t length = size_t(in.data[in.pos]) | size_t(in.data[in.pos + 1]) << 8;
+			in.pos += 4;
+			if (in.pos + length > in.size) { return false; }
+			out->insert(out->end(), in.data + in.pos, in.data + in.pos + length);
+			in.pos += length;
+		}
+		else if (type == 1) {
+			uint8_t lengths[320];
+			for (int i = 0; i < 144; i++) { lengths[i] = 8; }
+			for (int i = 144; i < 256; i++) { lengths[i] = 9; }
+			for (int i = 256; i < 280; i++) { lengths[i] = 7; }
+			for (int i = 280; i < 288; i++) { lengths[i] = 8; }
+			for (int i = 288; i < 318; i++) { lengths[i] = 5; }
+			Huffman literals, distances;
+			BuildHuffman(&literals, lengths, 288);
+			BuildHuffman(&distances, lengths + 288, 30);
+			if (!InflateBlock(&in, literals, distances, out)) { return false; }
+		}
+		else if (type == 2) {
+			int numLiterals = in.Bits(5) + 257, numDistances = in.Bits(5) + 1, numCodeLengths = in.Bits(4) + 4;
+			if (numLiterals > 286 || numDistances > 30) { return false; }
+
+			uint8_t lengths[320] = {};
+			for (int i = 0; i < numCodeLengths; i++) { lengths[codeLengthOrder[i]] = uint8_t(in.Bits(3)); }
+			Huffman codeLengths;
+			BuildHuffman(&codeLengths, lengths, 19);
+
+			int index = 0;
+			while (index < numLiterals + numDistances) {
+				int symbol = Decode(&in, codeLengths);
+				if (symbol < 0 || in.overrun) { return false; }
+				if (symbol < 16) { lengths[index++] = uint8_t(symbol); continue; }
+				uint8_t repeated = 0;
+				int count = 0;
+				if (symbol == 16) {
+					if (index == 0) { return false; }
+					repeated = lengths[index - 1];
+					count = 3 + in.Bits(2);
+				}
+				else if (symbol == 17) { count = 3 + in.Bits(3); }
+				else { count = 11 + in.Bits(7); }
+				if (index + count > numLiterals + numDistances) { return false; }
+				while (count-- > 0) { lengths[index++] = repeated; }
+			}
+
+			Huffman literals, distances;
+			BuildHuffman(&literals, lengths, numLiterals);
+			BuildHuffman(&distances, lengths + numLiterals, numDistances);
+			if (!InflateBlock(&in, literals, distances, out)) { return false; }
+		}
+		else { return false; }
+		if (in.overrun) { return false; }
+	}
+	return true;
+}
+
+uint32_t ReadBigEndian32(const uint8_t* p) { return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | uint32_t(p[3]); }
+
+uint8_t Paeth(int a, int b, int c) {
+	int p = a + b - c, pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+	if (pa <= pb && pa <= pc) { return uint8_t(a); }
+	return uint8_t(pb <= pc ? b : c);
+}
+
+float Luminance(float r, float g, float b) { return 0.2126f * r + 0.7152f * g + 0.0722f * b; }
+
+uint32_t Crc32(const uint8_t* data, size_t size, uint32_t crc = 0) {
+	static uint32_t table[256] = {};
+	if (table[1] == 0) {
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; k++) { c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1; }
+			table[i] = c;
+		}
+	}
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++) { crc = table[(crc ^ data[i]) & 255] ^ (crc >> 8); }
+	return ~crc;
+}
+
+uint32_t Adler32(const uint8_t* data, size_t size) {
+	uint32_t a = 1, b = 0;
+	for (size_t i = 0; i < size; i++) {
+		a = (a + data[i]) % 65521;
+		b = (b + a) % 65521;
+	}
+	return b << 16 | a;
+}
+
+void AppendBigEndian32(std::vector<uint8_t>* out, uint32_t value) {
+	for (int shift = 24; shift >= 0; shift -= 8) { out->push_back(uint8_t(value >> shift)); }
+}
+
+void WriteChunk(std::ofstream* file, const char* type, const std::vector<uint8_t>& data) {
+	std::vector<uint8_t> chunk;
+	chunk.reserve(data.size() + 12);
+	AppendBigEndian32(&chunk, uint32_t(data.size()));
+	chunk.insert(chunk.end(), type, type + 4);
+	chunk.insert(chunk.end(), data.begin(), data.end());
+	AppendBigEndian32(&chunk, Crc32(chunk.data() + 4, chunk.size() - 4));
+	file->write(reinterpret_cast<const char*>(chunk.data()), std::streamsize(chunk.size()));
+}
+
+struct BitWriter {	//the other way round, codes get packed least significant bit first
+	std::vector<uint8_t>* out;
+	uint32_t bitBuffer = 0;
+	int bitCount = 0;
+
+	void Bits(uint32_t value, int n) {	//n up to 16
+		bitBuffer |= value << bitCount;
+		bitCount += n;
+		while (bitCount >= 8) {
+			out->push_back(uint8_t(bitBuffer));
+			bitBuffer >>= 8;
+			bitCount -= 8;
+		}
+	}
+	void Code(uint32_t code, int n) {	//huffman codes go in most significant bit first
+		uint32_t reversed = 0;
+		for (int i = 0; i < n; i++) { reversed = reversed << 1 | ((code >> i) & 1); }
+		Bits(reversed, n);
+	}
+	void Flush() {
+		if (bitCount > 0) { out->push_back(uint8_t(bitBuffer)); }
+		bitBuffer = 0;
+		bitCount = 0;
+	}
+};
+
+void HuffmanLengths(std::vector<uint32_t> frequencies, int maxBits, std::vector<uint8_t>* lengths) {	//code lengths of a Huffman code for the frequencies, no longer than maxBits, unused symbols get 0
+	size_t n = frequencies.size();
+	while (true) {
+		using Node = std::pair<uint64_t, int>;	//weight, node, leaves are the symbols and the merged nodes come after them
+		std::priority_queue<Node, std::vector<Node>, std::greater<Node>> queue;
+		std::vector<int> parents(n, -1);
+		for (size_t i = 0; i < n; i++) { if (frequencies[i] > 0) { queue.push({ frequencies[i], int(i) }); } }
+		while (queue.size() > 1) {
+			Node a = queue.top(); queue.pop();
+			Node b = queue.top(); queue.pop();
+			parents.push_back(-1);
+			parents[a.second] = parents[b.second] = int(parents.size()) - 1;
+			queue.push({ a.first + b.first, int(parents.size()) - 1 });
+		}
+		lengths->assign(n, 0);
+		int longest = 0;
+		for (size_t i = 0; i < n; i++) {
+			if (frequencies[i] == 0) { continue; }
+			int depth = 0;
+			for (int node = int(i); parents[node] >= 0; node = parents[node]) { depth++; }
+			(*lengths)[i] = uint8_t(std::max(depth, 1));
+			longest = std::max(longest, depth);
+		}
+		if (longest <= maxBits) { return; }
+		for (uint32_t& frequency : frequencies) { if (frequency > 0) { frequency = frequency / 2 + 1; } }	//flattens the distribution until the tree is shallow enough, rare symbols lose a little
+	}
+}
+
+std::vector<uint16_t> CanonicalCodes(const std::vector<uint8_t>& lengths) {	//RFC 1951 3.2.2, codes of the same length are consecutive in symbol order
+	int lengthCount[16] = {};
+	for (uint8_t length : lengths) { if (length > 0) { lengthCount[length]++; } }
+	int nextCode[16] = {};
+	for (int bits = 1, code = 0; bits < 16; bits++) {
+		code = (code + lengthCount[bits - 1]) << 1;
+		nextCode[bits] = code;
+	}
+	std::vector<uint16_t> codes(lengths.size());
+	for (size_t i = 0; i < lengths.size(); i++) { if (lengths[i] > 0) { codes[i] = uint16_t(nextCode[lengths[i]]++); } }
+	return codes;
+}
+
+struct Token {	//one LZ77 step, a literal byte when distance is 0, otherwise a match of length bytes that many back
+	uint16_t value;
+	uint16_t distance;
+};
+
+int LengthSymbol(size_t length) { int symbol = 28; while (lengthBase[symbol] > length) { symbol--; } return symbol; }
+int DistanceSymbol(size_t distance) { int symbol = 29; while (distanceBase[symbol] > distance) { symbol--; } return symbol; }
+
+//zlib stream, greedy LZ77 matches from hash chains, then one block with Huffman codes built for exactly these tokens
+void Deflate(const std::vector<uint8_t>& raw, std::vector<uint8_t>* out) {
+	const size_t window = 32768, maxLength = 258, maxChain = 64;	//how far back a match may start, how long it may be, and how many earlier candidates get tried
+	const int hashBits = 15;
+	std::vector<int32_t> head(size_t(1) << hashBits, -1);	//latest position whose next three bytes hash to this
+	std::vector<int32_t> previous(window, -1);				//the position before it with the same hash, by position modulo the window
+	size_t n = raw.size();
+	auto hash = [&](size_t i) { return (uint32_t(raw[i]) << 16 | uint32_t(raw[i + 1]) << 8 | uint32_t(raw[i + 2])) * 2654435761u >> (32 - hashBits); };
+	auto insert = [&](size_t i) {
+		uint32_t h = hash(i);
+		previous[i % window] = head[h];
+		head[h] = int32_t(i);
+	};
+
+	std::vector<Token> tokens;
+	std::vector<uint32_t> literalFrequencies(286), distanceFrequencies(30);
+	for (size_t i = 0; i < n; ) {
+		size_t bestLength = 0, bestDistance = 0;
+		if (i + 3 <= n) {
+			size_t limit = std::min(maxLength, n - i);
+			int32_t candidate = head[hash(i)];
+			for (size_t chain = 0; candidate >= 0 && i - size_t(candidate) <= window && chain < maxChain; chain++) {
+				size_t length = 0;
+				while (length < limit && raw[size_t(candidate) + length] == raw[i + length]) { length++; }
+				if (length > bestLength) {
+					bestLength = length;
+					bestDistance = i - size_t(candidate);
+					if (length == limit) { break; }
+				}
+				candidate = previous[size_t(candidate) % window];
+			}
+			insert(i);
+		}
+		if (bestLength < 3) {
+			tokens.push_back({ raw[i], 0 });
+			literalFrequencies[raw[i]]++;
+			i++;
+			continue;
+		}
+		tokens.push_back({ uint16_t(bestLength), uint16_t(bestDistance) });
+		literalFrequencies[257 + LengthSymbol(bestLength)]++;
+		distanceFrequencies[DistanceSymbol(bestDistance)]++;
+		for (size_t k = 1; k < bestLength && i + k + 3 <= n; k++) { insert(i + k); }	//so later matches can start inside this one
+		i += bestLength;
+	}
+	literalFrequencies[256] = 1;	//end of block
+	for (std::vector<uint32_t>* frequencies : { &literalFrequencies, &distanceFrequencies }) {	//two used symbols at least, a one symbol code is a corner some decoders get wrong
+		size_t used = size_t(std::count_if(frequencies->begin(), frequencies->end(), [](uint32_t f) { return f > 0; }));
+		for (size_t k = 0; k < frequencies->size() && used < 2; k++) {
+			if ((*frequencies)[k] == 0) { (*frequencies)[k] = 1; used++; }
+		}
+	}
+
+	std::vector<uint8_t> literalLengths, distanceLengths;
+	HuffmanLengths(literalFrequencies, 15, &literalLengths);
+	HuffmanLengths(distanceFrequencies, 15, &distanceLengths);
+	int numLiterals = 286, numDistances = 30;
+	while (numLiterals > 257 && literalLengths[numLiterals - 1] == 0) { numLiterals--; }
+	while (numDistances > 1 && distanceLengths[numDistances - 1] == 0) { numDistances--; }
+
+	std::vector<uint8_t> allLengths(literalLengths.begin(), literalLengths.begin() + numLiterals);	//both code's lengths back to back get run length coded with symbols 16-18
+	allLengths.insert(allLengths.end(), distanceLengths.begin(), distanceLengths.begin() + numDistances);
+	std::vector<std::pair<uint8_t, uint8_t>> runs;	//code length symbol and its extra bits
+	std::vector<uint32_t> codeLengthFrequencies(19);
+	for (size_t i = 0; i < allLengths.size(); ) {
+		size_t run = 1;
+		while (i + run < allLengths.size() && allLengths[i + run] == allLengths[i]) { run++; }
+		if (allLengths[i] == 0 && run >= 3) {
+			run = std::min<size_t>(run, 138);
+			runs.push_back(run >= 11 ? std::pair<uint8_t, uint8_t>{ 18, uint8_t(run - 11) } : std::pair<uint8_t, uint8_t>{ 17, uint8_t(run - 3) });
+		}
+		else if (allLengths[i] != 0 && run >= 4) {	//the length itself once, then repeats of it
+			run = std::min<size_t>(run, 7);
+			runs.push_back({ allLengths[i], 0 });
+			runs.push_back({ 16, uint8_t(run - 4) });
+		}
+		else {
+			run = 1;
+			runs.push_back({ allLengths[i], 0 });
+		}
+		i += run;
+	}
+	for (const auto& step : runs) { codeLengthFrequencies[step.first]++; }
+	std::vector<uint8_t> codeLengthLengths;
+	HuffmanLengths(codeLengthFrequencies, 7, &codeLengthLengths);
+	int numCodeLengths = 19;
+	while (numCodeLengths > 4 && codeLengthLengths[codeLengthOrder[numCodeLengths - 1]] == 0) { numCodeLengths--; }
+
+	std::vector<uint16_t> literalCodes = CanonicalCodes(literalLengths), distanceCodes = CanonicalCodes(distanceLengths), codeLengthCodes = CanonicalCodes(codeLengthLengths);
+	out->push_back(0x78);
+	out->push_back(0x01);
+	BitWriter bits{ out };
+	bits.Bits(1, 1);	//final block
+	bits.Bits(2, 2);	//dynamic codes
+	bits.Bits(uint32_t(numLiterals - 257), 5);
+	bits.Bits(uint32_t(numDistances - 1), 5);
+	bits.Bits(uint32_t(numCodeLengths - 4), 4);
+	for (int i = 0; i < numCodeLengths; i++) { bits.Bits(codeLengthLengths[codeLengthOrder[i]], 3); }
+	static const int runExtra[3] = { 2, 3, 7 };	//extra bits of symbols 16, 17 and 18
+	for (const auto& step : runs) {
+		bits.Code(codeLengthCodes[step.first], codeLengthLengths[step.first]);
+		if (step.first >= 16) { bits.Bits(step.second, runExtra[step.first - 16]); }
+	}
+	for (const Token& token : tokens) {
+		if (token.distance == 0) { bits.Code(literalCodes[token.value], literalLengths[token.value]); continue; }
+		int symbol = LengthSymbol(token.value), distanceSymbol = DistanceSymbol(token.distance);
+		bits.Code(literalCodes[257 + symbol], literalLengths[257 + symbol]);
+		bits.Bits(uint32_t(token.value - lengthBase[symbol]), lengthExtra[symbol]);
+		bits.Code(distanceCodes[distanceSymbol], distanceLengths[distanceSymbol]);
+		bits.Bits(uint32_t(token.distance - distanceBase[distanceSymbol]), distanceExtra[distanceSymbol]);
+	}
+	bits.Code(literalCodes[256], literalLengths[256]);
+	bits.Flush();
+	AppendBigEndian32(out, Adler32(raw.data(), raw.size()));
+}
+
+void FilterRow(const uint8_t* row, const uint8_t* above, size_t rowBytes, int bytesPerPixel, std::vector<uint8_t>* out) {	//appends the row with whichever of the five PNG filters leaves the smallest residuals, the usual heuristic for what deflates best
+	std::vector<uint8_t> best, candidate(rowBytes + 1);
+	long bestCost = -1;
+	for (int filter = 0; filter < 5; filter++) {
+		candidate[0] = uint8_t(filter);
+		long cost = 0;
+		for (size_t x = 0; x < rowBytes; x++) {
+			int a = x >= size_t(bytesPerPixel) ? row[x - bytesPerPixel] : 0, b = above[x], c = x >= size_t(bytesPerPixel) ? above[x - bytesPerPixel] : 0;
+			int predicted = filter == 0 ? 0 : filter == 1 ? a : filter == 2 ? b : filter == 3 ? (a + b) / 2 : Paeth(a, b, c);
+			uint8_t residual = uint8_t(row[x] - predicted);
+			candidate[x + 1] = residual;
+			cost += std::abs(int(int8_t(residual)));
+		}
+		if (bestCost < 0 || cost < bestCost) { bestCost = cost; best = candidate; }
+	}
+	out->insert(out->end(), best.begin(), best.end());
+}
+
+}
+
+bool ReadPNG(const std::string& path, int* width, int* height, std::vector<float>* gray) {
+	MappedFile file(path);
+	const uint8_t* data = reinterpret_cast<const uint8_t*>(file.Data());
+	static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	if (!file.IsOpen() || file.Size() < 8 || std::memcmp(data, signature, 8) != 0) { std::cout << "Invalid png " << path << "\n"; return false; }
+
+	uint32_t w = 0, h = 0;
+	int bitDepth = 0, colorType = 0, interlace = 0;
+	float palette[256] = {};
+	std::vector<uint8_t> compressed;
+	for (size_t pos = 8; pos + 12 <= file.Size(); ) {
+		uint32_t length = ReadBigEndian32(data + pos);
+		const uint8_t* type = data + pos + 4;
+		const uint8_t* chunk = data + pos + 8;
+		if (pos + 12 + length > file.Size()) { break; }
+		if (std::memcmp(type, "IHDR", 4) == 0 && length >= 13) {
+			w = ReadBigEndian32(chunk);
+			h = ReadBigEndian32(chunk + 4);
+			bitDepth = chunk[8];
+			colorType = chunk[9];
+			interlace = chunk[12];
+		}
+		else if (std::memcmp(type, "PLTE", 4) == 0) {
+			for (uint32_t i = 0; i < length / 3 && i < 256; i++) { palette[i] = Luminance(chunk[3 * i] / 255.0f, chunk[3 * i + 1] / 255.0f, chunk[3 * i + 2] / 255.0f); }
+		}
+		else if (std::memcmp(type, "IDAT", 4) == 0) { compressed.insert(compressed.end(), chunk, chunk + length); }
+		else if (std::memcmp(type, "IEND", 4) == 0) { break; }
+		pos += 12 + length;
+	}
+
+	int channels = colorType == 0 ? 1 : colorType == 2 ? 3 : colorType == 3 ? 1 : colorType == 4 ? 2 : colorType == 6 ? 4 : 0;
+	if (w == 0 || h == 0 || channels == 0 || interlace != 0 || (bitDepth != 1 && bitDepth != 2 && bitDepth != 4 && bitDepth != 8 && bitDepth != 16)) {
+		std::cout << "Unsupported png " << path << "\n";
+		return false;
+	}
+
+	size_t rowBytes = (size_t(w) * size_t(channels) * size_t(bitDepth) + 7) / 8;
+	size_t pixelBytes = std::max<size_t>(1, size_t(channels) * size_t(bitDepth) / 8);	//the filters look back one whole pixel, or one byte for packed samples
+	std::vector<uint8_t> raw;
+	raw.reserve((rowBytes + 1) * h);
+	if (!Inflate(compressed.data(), compressed.size(), &raw) || raw.size() < (rowBytes + 1) * h) { std::cout << "Corrupt png " << path << "\n"; return false; }
+
+	std::vector<uint8_t> previous(rowBytes, 0), row(rowBytes);
+	gray->resize(size_t(w) * size_t(h));
+	float maxSample = float((1u << bitDepth) - 1);
+	for (uint32_t y = 0; y < h; y++) {
+		const uint8_t* line = raw.data() + y * (rowBytes + 1);
+		int filter = line[0];
+		for (size_t i = 0; i < rowBytes; i++) {	//undo the per-row prediction filter
+			int a = i >= pixelBytes ? row[i - pixelBytes] : 0, b = previous[i], c = i >= pixelBytes ? previous[i - pixelBytes] : 0;
+			int predictor = filter == 1 ? a : filter == 2 ? b : filter == 3 ? (a + b) / 2 : filter == 4 ? Paeth(a, b, c) : 0;
+			row[i] = uint8_t(line[1 + i] + predictor);
+		}
+
+		auto sample = [&](size_t index) -> uint32_t {	//index counts samples along the row, not bytes
+			if (bitDepth == 16) { return uint32_t(row[2 * index]) << 8 | row[2 * index + 1]; }
+			if (bitDepth == 8) { return row[index]; }
+			size_t bit = index * size_t(bitDepth);
+			return (row[bit / 8] >> (8 - bitDepth - int(bit % 8))) & ((1u << bitDepth) - 1);
+		};
+		float* out = gray->data() + size_t(y) * w;
+		for (uint32_t x = 0; x < w; x++) {
+			size_t s = size_t(x) * size_t(channels);
+			if (colorType == 3) { out[x] = palette[sample(s) & 255]; }
+			else if (channels >= 3) { out[x] = Luminance(sample(s) / maxSample, sample(s + 1) / maxSample, sample(s + 2) / maxSample); }
+			else { out[x] = sample(s) / maxSample; }	//gray, any alpha is ignored
+		}
+		std::swap(previous, row);
+	}
+
+	*width = int(w);
+	*height = int(h);
+	return true;
+}
+
+bool WritePNG(const std::string& path, int width, int height, const unsigned char* pixels, int channels) {
+	if (channels != 1 && channels != 3) { std::cout << "Can only write gray or RGB PNGs, not " << channels << " channels\n"; return false; }
+	std::ofstream file(path, std::ios::binary);
+	if (!file.is_open()) { std::cout << "Couldn't write " << path << "\n"; return false; }
+
+	size_t rowBytes = size_t(width) * size_t(channels);
+	std::vector<uint8_t> raw;
+	raw.reserve((rowBytes + 1) * size_t(height));
+	std::vector<uint8_t> zeros(rowBytes);	//what the first row gets predicted from
+	for (int y = 0; y < height; y++) { FilterRow(pixels + size_t(y) * rowBytes, y > 0 ? pixels + size_t(y - 1) * rowBytes : zeros.data(), rowBytes, channels, &raw); }
+
+	std::vector<uint8_t> header;
+	AppendBigEndian32(&header, uint32_t(width));
+	AppendBigEndian32(&header, uint32_t(height));
+	header.insert(header.end(), { 8, uint8_t(channels == 3 ? 2 : 0), 0, 0, 0 });	//8 bit grayscale or truecolour, no interlacing
+	std::vector<uint8_t> compressed;
+	Deflate(raw, &compressed);
+
+	static const char signature[8] = { char(0x89), 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	file.write(signature, 8);
+	WriteChunk(&file, "IHDR", header);
+	WriteChunk(&file, "IDAT", compressed);
+	WriteChunk(&file, "IEND", {});
+	return bool(file);
+}
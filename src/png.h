@@ -0,0 +1,9 @@
+#pragma once
+#include <string>
+#include <vector>
+
+//decodes a non-interlaced PNG of any colour type at 1-16 bits per sample into one channel in [0, 1], colour images get converted to luminance
+//16 bit samples keep their full precision, which is what heightfields need
+bool ReadPNG(const std::string& path, int* width, int* height, std::vector<float>* gray);
+
+bool WritePNG(const std::string& path, int width, int height, const unsigned char* pixels, int channels = 1);	//8 bit grayscale, or RGB with 3 channels, pixels holds width * height * channels bytes row by row
@@ -0,0 +1,85 @@
+#include "profile.h"
+
+#ifdef CAUSTICS_PROFILE
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+
+struct ProfileEvent {
+	const char* name;
+	int64_t begin;
+	int64_t end;	//for counters the time it changed
+	uint32_t thread;
+	double value;	//running total of a counter within its frame
+	bool counter;
+};
+
+static std::mutex profileMutex;	//a handful of events per stage and frame, a lock is cheaper than getting per-thread buffers right
+static std::vector<ProfileEvent> events;
+static std::vector<ProfileEntry> currentFrame, lastFrame;
+static const size_t maxEvents = size_t(1) << 22;	//about 160MB, enough for a long session without growing forever
+static const std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+
+static uint32_t ThreadNumber() {	//small stable numbers read better in the trace viewer than hashed thread ids
+	static std::atomic<uint32_t> next(0);
+	thread_local uint32_t number = next++;
+	return number;
+}
+
+static ProfileEntry* FrameEntry(const char* name, bool counter) {	//needs profileMutex
+	for (ProfileEntry& entry : currentFrame) {
+		if (entry.counter == counter && (entry.name == name || std::strcmp(entry.name, name) == 0)) { return &entry; }
+	}
+	currentFrame.push_back({ name, 0, counter });
+	return &currentFrame.back();
+}
+
+int64_t Profiler::Now() { return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count(); }
+
+void Profiler::Record(const char* name, int64_t begin, int64_t end) {
+	uint32_t thread = ThreadNumber();
+	std::lock_guard<std::mutex> lock(profileMutex);
+	FrameEntry(name, false)->value += double(end - begin) * 1e-6;
+	if (events.size() < maxEvents) { events.push_back({ name, begin, end, thread, 0, false }); }
+}
+
+void Profiler::Count(const char* name, double amount) {
+	int64_t now = Now();
+	uint32_t thread = ThreadNumber();
+	std::lock_guard<std::mutex> lock(profileMutex);
+	ProfileEntry* entry = FrameEntry(name, true);
+	entry->value += amount;
+	if (events.size() < maxEvents) { events.push_back({ name, now, now, thread, entry->value, true }); }
+}
+
+void Profiler::EndFrame() {
+	std::lock_guard<std::mutex> lock(profileMutex);
+	lastFrame = currentFrame;
+	for (ProfileEntry& entry : currentFrame) { entry.value = 0; }
+}
+
+std::vector<ProfileEntry> Profiler::LastFrame() {
+	std::lock_guard<std::mutex> lock(profileMutex);
+	return lastFrame;
+}
+
+bool Profiler::WriteTrace(const std::string& path) {
+	std::ofstream file(path);
+	if (!file.is_open()) { std::cout << "Couldn't write " << path << "\n"; return false; }
+	std::lock_guard<std::mutex> lock(profileMutex);
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";	//complete events and counters, timestamps in microseconds
+	for (size_t i = 0; i < events.size(); i++) {
+		const ProfileEvent& e = events[i];
+		file << "{\"name\":\"" << e.name << "\",\"pid\":1,\"tid\":" << e.thread << ",\"ts\":" << double(e.begin) * 1e-3;
+		if (e.counter) { file << ",\"ph\":\"C\",\"args\":{\"value\":" << e.value << "}}"; }
+		else { file << ",\"ph\":\"X\",\"dur\":" << double(e.end - e.begin) * 1e-3 << "}"; }
+		file << (i + 1 < events.size() ? ",\n" : "\n");
+	}
+	file << "]}\n";
+	if (events.size() == maxEvents) { std::cout << "The trace filled up, later events were dropped\n"; }
+	return bool(file);
+}
+#endif
@@ -0,0 +1,46 @@
+#pragma once
+
+//per-stage timers and counters for finding out where a slow frame goes, compiled in with -DCAUSTICS_PROFILE, without it the macros expand to nothing and none of this exists
+//PROFILE_SCOPE("name") times the rest of the enclosing block, PROFILE_COUNT("name", amount) adds to a counter, the amount isn't even evaluated when profiling is off
+//both are safe from any thread, names have to be string literals since only the pointer gets kept
+#ifdef CAUSTICS_PROFILE
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct ProfileEntry {
+	const char* name;
+	double value;	//milliseconds for a scope, summed over every thread, the total for a counter
+	bool counter;
+};
+
+class Profiler {
+public:
+	static int64_t Now();	//nanoseconds since startup
+	static void Record(const char* name, int64_t begin, int64_t end);	//a finished scope, goes into the trace and into this frame's totals
+	static void Count(const char* name, double amount);
+	static void EndFrame();	//this frame's totals become the ones LastFrame returns, and the next frame starts from zero
+	static std::vector<ProfileEntry> LastFrame();	//in the order the names first showed up
+	static bool WriteTrace(const std::string& path);	//everything recorded so far as Chrome trace event JSON, for chrome://tracing or ui.perfetto.dev
+};
+
+class ProfileScope {
+public:
+	explicit ProfileScope(const char* name) : name(name), begin(Profiler::Now()) {}
+	~ProfileScope() { Profiler::Record(name, begin, Profiler::Now()); }
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+	const char* name;
+	int64_t begin;
+};
+
+#define PROFILE_JOIN_(a, b) a##b
+#define PROFILE_JOIN(a, b) PROFILE_JOIN_(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_JOIN(profileScope, __LINE__)(name)
+#define PROFILE_COUNT(name, amount) Profiler::Count(name, double(amount))
+#else
+#define PROFILE_SCOPE(name) ((void)0)
+#define PROFILE_COUNT(name, amount) ((void)0)
+#endif
@@ -0,0 +1,31 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+
+template <typename T, size_t Capacity>
+class SpscQueue {	//bounded ring for one producer thread and one consumer thread, each side only ever writes its own index so there are no locks, a full or empty queue blocks on the index instead of spinning
+public:
+	void Push(T value) {
+		size_t tail = this->tail.load(std::memory_order_relaxed);
+		size_t head;
+		while (tail - (head = this->head.load(std::memory_order_acquire)) == Capacity) { this->head.wait(head, std::memory_order_acquire); }	//full, wait for the consumer to move on
+		slots[tail % Capacity] = value;
+		this->tail.store(tail + 1, std::memory_order_release);
+		this->tail.notify_one();
+	}
+
+	T Pop() {
+		size_t head = this->head.load(std::memory_order_relaxed);
+		size_t tail;
+		while ((tail = this->tail.load(std::memory_order_acquire)) == head) { this->tail.wait(tail, std::memory_order_acquire); }	//empty, wait for the producer
+		T value = slots[head % Capacity];
+		this->head.store(head + 1, std::memory_order_release);
+		this->head.notify_one();
+		return value;
+	}
+
+private:
+	alignas(64) std::atomic<size_t> head{ 0 };	//next slot to pop, on its own cache line so the two threads don't keep stealing it from each other
+	alignas(64) std::atomic<size_t> tail{ 0 };	//next slot to push
+	T slots[Capacity];
+};
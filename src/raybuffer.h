@@ -0,0 +1,142 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <span>
+#include <utility>
+#include <vector>
+#include "Eigen/Core"
+#include "threadpool.h"
+
+template <typename T>
+struct UninitializedAllocator : std::allocator<T> {	//lets resize() skip the zero fill, so the pages of a big array are first touched by whichever pool thread fills that chunk and get placed on its NUMA node
+	template <typename U> struct rebind { using other = UninitializedAllocator<U>; };
+	UninitializedAllocator() = default;
+	template <typename U> UninitializedAllocator(const UninitializedAllocator<U>&) noexcept {}
+	template <typename U> void construct(U* p) noexcept { ::new (static_cast<void*>(p)) U; }
+	template <typename U, typename... Args> void construct(U* p, Args&&... args) { ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...); }
+};
+
+template <typename T>
+using RayArray = std::vector<T, UninitializedAllocator<T>>;	//per-ray component array, contents are garbage after resize until a kernel writes them
+
+template <typename T>
+struct RayBuffer {	//structure of arrays version of vertices/normals/refracteds, every component gets its own contiguous array so the kernels can fill whole SIMD registers with one load
+	std::span<const T> vx, vy, vz;	//vertex positions, views into meshStorage or into a memory mapped mesh cache that has to outlive the buffer
+	std::span<const T> nx, ny, nz;	//normals, one per vertex unless normalIndex is set
+	std::span<const uint32_t> normalIndex;	//vertex i uses normal normalIndex[i], empty when normal i simply belongs to vertex i
+	RayArray<T> rx, ry, rz;	//refracted directions
+	RayArray<T> irz;		//1 / rz, the directions don't change when only the receiver plane moves so the intersection kernel doesn't have to divide
+	RayArray<T> meshStorage;	//the six vertex/normal components back to back when the buffer owns them, empty when viewing a cache
+	std::vector<uint32_t> normalIndexStorage;
+	std::span<const uint32_t> triangles;	//three vertex indices per mesh triangle, empty unless the faces were read
+	std::vector<uint32_t> triangleStorage;
+
+	RayBuffer() = default;
+	RayBuffer(const RayBuffer&) = delete;	//a copy would keep viewing the original's storage
+	RayBuffer& operator=(const RayBuffer&) = delete;
+	RayBuffer(RayBuffer&&) = default;		//moving a vector keeps its allocation, so the views stay valid
+	RayBuffer& operator=(RayBuffer&&) = default;
+
+	size_t Size() const { return vx.size(); }
+
+	void Resize(size_t n) { Resize(n, n); }
+
+	void Resize(size_t n, size_t numNormals) {	//owns the mesh, the three vertex components and then the three normal components back to back in meshStorage
+		meshStorage.resize(3 * n + 3 * numNormals);
+		T* mesh = meshStorage.data();
+		vx = { mesh, n }; vy = { mesh + n, n }; vz = { mesh + 2 * n, n };
+		mesh += 3 * n;
+		nx = { mesh, numNormals }; ny = { mesh + numNormals, numNormals }; nz = { mesh + 2 * numNormals, numNormals };
+		normalIndexStorage.clear();
+		normalIndex = {};
+		triangleStorage.clear();
+		triangles = {};
+		ResizeOutputs(n);
+	}
+
+	void View(std::span<const T> x, std::span<const T> y, std::span<const T> z, std::span<const T> normalX, std::span<const T> normalY, std::span<const T> normalZ, std::span<const uint32_t> index = {}, std::span<const uint32_t> faces = {}) {	//uses somebody else's vertex/normal arrays in place
+		meshStorage = {};
+		normalIndexStorage = {};
+		triangleStorage = {};
+		vx = x; vy = y; vz = z;
+		nx = normalX; ny = normalY; nz = normalZ;
+		normalIndex = index;
+		triangles = faces;
+		ResizeOutputs(x.size());
+	}
+
+	T* MeshComponent(int k) { return meshStorage.data() + (k < 3 ? size_t(k) * Size() : 3 * Size() + size_t(k - 3) * nx.size()); }	//writable owned vertex/normal component, 0-2 vertex x,y,z, 3-5 normal x,y,z
+	size_t NumNormals() const { return nx.size(); }
+
+	void ResizeOutputs(size_t n) {
+		for (RayArray<T>* component : { &rx, &ry, &rz, &irz }) { component->resize(n); }
+	}
+};
+
+template <typename T>
+struct IntersectionCache {	//the target image position of a ray is affine in the receiver plane distance d, ix = baseX + slopeX * d, so once the directions are known a new frame only needs these
+	RayArray<T> baseX, baseY;
+	RayArray<T> slopeX, slopeY;
+
+	size_t Size() const { return baseX.size(); }
+
+	void Resize(size_t n) {
+		for (RayArray<T>* component : { &baseX, &baseY, &slopeX, &slopeY }) { component->resize(n); }
+	}
+};
+
+template <typename T, typename U>
+void ConvertCache(const IntersectionCache<U>& from, IntersectionCache<T>* to, ThreadPool* pool = nullptr) {	//the same rays at another precision, for preparing in double and then re-solving every frame from half the bytes in float
+	to->Resize(from.Size());
+	auto convert = [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			to->baseX[i] = T(from.baseX[i]); to->baseY[i] = T(from.baseY[i]);
+			to->slopeX[i] = T(from.slopeX[i]); to->slopeY[i] = T(from.slopeY[i]);
+		}
+	};
+	if (pool != nullptr) { pool->ParallelFor(from.Size(), convert); }
+	else { convert(0, from.Size()); }
+}
+
+template <typename T>
+void FillRayBuffer(std::span<const Eigen::Vector3d> vertices, std::span<const Eigen::Vector3d> normals, RayBuffer<T>* rays, ThreadPool* pool = nullptr) {	//splits the parsed vertices and normals into the per-component arrays
+	rays->Resize(vertices.size());
+	T* vx = rays->MeshComponent(0); T* vy = rays->MeshComponent(1); T* vz = rays->MeshComponent(2);
+	T* nx = rays->MeshComponent(3); T* ny = rays->MeshComponent(4); T* nz = rays->MeshComponent(5);
+	auto fill = [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			vx[i] = T(vertices[i].x()); vy[i] = T(vertices[i].y()); vz[i] = T(vertices[i].z());
+			nx[i] = T(normals[i].x()); ny[i] = T(normals[i].y()); nz[i] = T(normals[i].z());
+		}
+	};
+	if (pool != nullptr) { pool->ParallelFor(vertices.size(), fill); }
+	else { fill(0, vertices.size()); }
+}
+
+template <typename T>
+void FillRayBuffer(std::span<const Eigen::Vector3d> vertices, std::span<const Eigen::Vector3d> normals, std::vector<uint32_t>&& normalIndex, std::vector<uint32_t>&& triangles, RayBuffer<T>* rays, ThreadPool* pool = nullptr) {	//same, for meshes read through their faces, an empty index means vertices and normals pair up one to one
+	std::vector<uint32_t> faces = std::move(triangles);	//Resize clears the buffer's triangles, so they go in after the fill
+	if (normalIndex.empty()) {
+		FillRayBuffer(vertices, normals, rays, pool);
+		rays->triangleStorage = std::move(faces);
+		rays->triangles = rays->triangleStorage;
+		return;
+	}
+	rays->Resize(vertices.size(), normals.size());
+	T* components[6];
+	for (int k = 0; k < 6; k++) { components[k] = rays->MeshComponent(k); }
+	auto fillVertices = [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) { for (int k = 0; k < 3; k++) { components[k][i] = T(vertices[i][k]); } }
+	};
+	auto fillNormals = [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) { for (int k = 0; k < 3; k++) { components[3 + k][i] = T(normals[i][k]); } }
+	};
+	if (pool != nullptr) { pool->ParallelFor(vertices.size(), fillVertices); pool->ParallelFor(normals.size(), fillNormals); }
+	else { fillVertices(0, vertices.size()); fillNormals(0, normals.size()); }
+	rays->normalIndexStorage = std::move(normalIndex);
+	rays->normalIndex = rays->normalIndexStorage;
+	rays->triangleStorage = std::move(faces);
+	rays->triangles = rays->triangleStorage;
+}
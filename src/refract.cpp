@@ -1,74 +1,825 @@
 #include "refract.h"
 
-std::vector<std::string> split(std::string s, std::string delimiter) {	//splits a string into several smaller strings separated by a given delimiter, from https://stackoverflow.com/questions/14265581/parse-split-a-string-in-c-using-string-delimiter-standard-c
-	size_t pos_start = 0, pos_end, delim_len = delimiter.length();
-	std::string token;
-	std::vector<std::string> res;
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <functional>
+#include <cstring>
+#include "Eigen/Geometry"
+#include "mappedfile.h"
+#include "profile.h"
+#include "simd.h"
 
-	while ((pos_end = s.find(delimiter, pos_start)) != std::string::npos) {
-		token = s.substr(pos_start, pos_end - pos_start);
-		pos_start = pos_end + delim_len;
-		res.push_back(token);
+static const Eigen::Vector3d TIR(.9999, 0, 0.0141418);	//in the case of total internal reflection, shoot the light way off to the side in an arbitrary direction so that it doesn't show up on the part of the screen we see
+
+#ifdef CAUSTICS_PROFILE
+template <typename T>
+static size_t CountTIR(const IntersectionCache<T>& cache) {	//every kernel computes the slope of a lost ray the same way, so they all come out as exactly this
+	const T slope = T(TIR.x()) * (T(1) / T(TIR.z())) * T(targetScale);
+	return size_t(std::count(cache.slopeX.begin(), cache.slopeX.end(), slope));
+}
+#endif
+
+static const char* NextLine(const char* p, const char* end) {	//returns the start of the line after the one p is in
+	const char* newline = static_cast<const char*>(std::memchr(p, '\n', size_t(end - p)));
+	return newline == nullptr ? end : newline + 1;
+}
+
+static const char* ParseDouble(const char* p, const char* end, double* out) {	//parses one number, returns nullptr if there isn't one
+	static const double powersOfTen[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+	const char* start = p;
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')) { negative = *p == '-'; p++; }
+
+	uint64_t mantissa = 0;	//exporters write plain decimals like -0.123456, so gather the digits into an integer and scale once at the end
+	int digits = 0, exponent = 0;
+	const char* digitsStart = p;
+	while (p < end && unsigned(*p - '0') < 10) { mantissa = mantissa * 10 + unsigned(*p - '0'); digits++; p++; }
+	if (p < end && *p == '.') {
+		p++;
+		while (p < end && unsigned(*p - '0') < 10) { mantissa = mantissa * 10 + unsigned(*p - '0'); digits++; exponent--; p++; }
 	}
+	bool plainDecimal = p < end ? (*p != 'e' && *p != 'E') : true;
 
-	res.push_back(s.substr(pos_start));
-	return res;
+	if (digits > 0 && digits <= 15 && plainDecimal && -exponent <= 22) {	//exact fast path, the mantissa fits in a double and dividing by an exact power of ten rounds the same way stod does
+		double value = double(mantissa) / powersOfTen[-exponent];
+		*out = negative ? -value : value;
+		return p;
+	}
+
+	if (p == digitsStart) { return nullptr; }
+	std::from_chars_result result = std::from_chars(*start == '+' ? start + 1 : start, end, *out);	//long mantissas and exponents go through the slow but exact parser, from_chars doesn't accept a leading +
+	return result.ec == std::errc() ? result.ptr : nullptr;
 }
 
-void ParseOBJ(std::string objFilePath, std::vector<Eigen::Vector3d>* vertices, std::vector<Eigen::Vector3d>* normals) {	//takes in an .obj file and populates vertices and normals from the file
-	
-	std::string line;
-	std::ifstream file(objFilePath);
-	if (file.is_open()) {
-		while (std::getline(file, line))
-		{
-			if (line.substr(0,2) == "v ") {
-				std::vector<std::string> lineContents = split(line, " ");
-				Eigen::Vector3d vertex(std::stod(lineContents[1]), std::stod(lineContents[2]), std::stod(lineContents[3]));
-				vertices->push_back(vertex);
+static bool ParseVector3(const char* p, const char* end, Eigen::Vector3d* out) {	//parses three whitespace separated numbers in place, no copying the line into strings
+	for (int k = 0; k < 3; k++) {
+		while (p < end && (*p == ' ' || *p == '\t')) { p++; }
+		p = ParseDouble(p, end, &(*out)[k]);
+		if (p == nullptr) { return false; }
+	}
+	return true;
+}
+
+static const char* ParseFaceCorner(const char* p, const char* end, long long* vertex, long long* normal) {	//one "v", "v/vt", "v//vn" or "v/vt/vn" corner of an f record, normal is 0 if it has none, returns nullptr once there are no more corners
+	while (p < end && (*p == ' ' || *p == '\t')) { p++; }
+	std::from_chars_result result = std::from_chars(p, end, *vertex);
+	if (result.ec != std::errc()) { return nullptr; }
+	p = result.ptr;
+	*normal = 0;
+	if (p < end && *p == '/') {
+		long long texture;
+		result = std::from_chars(++p, end, texture);
+		if (result.ec == std::errc()) { p = result.ptr; }
+		if (p < end && *p == '/') {
+			result = std::from_chars(++p, end, *normal);
+			if (result.ec == std::errc()) { p = result.ptr; }
+		}
+	}
+	return p;
+}
+
+static void ParseFace(const char* p, const char* end, size_t numVertices, size_t numNormals, uint32_t firstVertex, std::vector<uint32_t>* corners, std::vector<uint32_t>* triangles) {	//appends a vertex, normal pair for every corner that names a normal, and fans the face out into triangles
+	long long vertex, normal;
+	uint32_t first = 0, previous = 0;
+	int numCorners = 0;
+	while ((p = ParseFaceCorner(p, end, &vertex, &normal)) != nullptr) {
+		long long v = vertex > 0 ? vertex - 1 : (long long)numVertices + vertex;	//obj indices start at 1, negative ones count back from the last one so far
+		if (v < 0 || v >= (long long)UINT32_MAX) { continue; }
+		if (triangles != nullptr) {
+			uint32_t corner = firstVertex + uint32_t(v);
+			if (numCorners == 0) { first = corner; }
+			else if (numCorners >= 2) { triangles->insert(triangles->end(), { first, previous, corner }); }
+			previous = corner;
+			numCorners++;
+		}
+
+		if (normal == 0) { continue; }
+		long long n = normal > 0 ? normal - 1 : (long long)numNormals + normal;
+		if (n < 0 || n >= (long long)UINT32_MAX) { continue; }
+		corners->insert(corners->end(), { uint32_t(v), uint32_t(n) });
+	}
+}
+
+struct OBJChunk {	//one thread's share of the file, split on line boundaries
+	const char* begin = nullptr;
+	const char* end = nullptr;
+	size_t numVertices = 0, numNormals = 0;		//v and vn lines in it, up to the vt cutoff
+	size_t firstVertex = 0, firstNormal = 0;	//prefix sums of the counts, where its lines go in the output so the file order is kept
+	size_t parsedVertices = 0, parsedNormals = 0;	//fewer than counted if some lines didn't parse
+	bool cut = false;							//it has the first vt line, nothing after it gets read
+	std::vector<uint32_t> corners;				//vertex, normal pairs of its f records in file order
+	std::vector<uint32_t> triangles;
+};
+
+static void CountChunk(OBJChunk* chunk, size_t index, bool readFaces, std::atomic<size_t>* firstCut) {
+	size_t lines = 0;
+	for (const char* line = chunk->begin; line < chunk->end; line = NextLine(line, chunk->end)) {
+		if (++lines % 4096 == 0 && firstCut->load(std::memory_order_relaxed) < index) { return; }	//an earlier chunk already got to the texture coordinates, none of this gets used
+		if (chunk->end - line < 2) { break; }
+		if (line[0] == 'v' && line[1] == ' ') { chunk->numVertices++; }
+		else if (line[0] == 'v' && line[1] == 'n') { chunk->numNormals++; }
+		else if (line[0] == 'v' && line[1] == 't' && !readFaces) {
+			chunk->cut = true;
+			size_t previous = firstCut->load();
+			while (index < previous && !firstCut->compare_exchange_weak(previous, index)) {}
+			return;
+		}
+	}
+}
+
+static void ParseChunk(OBJChunk* chunk, bool readFaces, bool readTriangles, size_t fileVertex, Eigen::Vector3d* vertices, Eigen::Vector3d* normals) {	//vertices and normals point at where this file starts in the outputs
+	size_t v = chunk->firstVertex, n = chunk->firstNormal;
+	Eigen::Vector3d value;
+	for (const char* line = chunk->begin; line < chunk->end; ) {
+		const char* next = NextLine(line, chunk->end);
+		if (readFaces && next - line >= 2 && line[0] == 'f' && line[1] == ' ') {
+			ParseFace(line + 2, next, v, n, uint32_t(fileVertex), &chunk->corners, readTriangles ? &chunk->triangles : nullptr);
+		}
+		else if (next - line >= 2 && line[0] == 'v') {
+			if (line[1] == ' ') {
+				if (ParseVector3(line + 2, next, &value)) { vertices[v++] = value; }
+			}
+			else if (line[1] == 'n') {
+				if (ParseVector3(line + 2, next, &value)) { normals[n++] = value; }
 			}
-			else if (line.substr(0, 2) == "vn") {
-				std::vector<std::string> lineContents = split(line, " ");
-				Eigen::Vector3d normal(std::stod(lineContents[1]), std::stod(lineContents[2]), std::stod(lineContents[3]));
-				normals->push_back(normal);
+			else if (line[1] == 't' && !readFaces) { break; }	//we don't care about anything beyond the vertices and normals, no point reading stuff we're not going to use
+		}
+		line = next;
+	}
+	chunk->parsedVertices = v - chunk->firstVertex;
+	chunk->parsedNormals = n - chunk->firstNormal;
+}
+
+void ParseOBJ(std::string objFilePath, std::vector<Eigen::Vector3d>* vertices, std::vector<Eigen::Vector3d>* normals, std::vector<uint32_t>* normalIndex, std::vector<uint32_t>* triangles, ThreadPool* pool) {	//takes in an .obj file and populates vertices and normals from the file
+	
+	MappedFile file(objFilePath);
+	if (!file.IsOpen()) { std::cout << "Invalid file\n"; return; }
+	PROFILE_SCOPE("parse obj");
+	PROFILE_COUNT("bytes parsed", file.Size());
+	const char* begin = file.Data();
+	const char* end = begin + file.Size();
+
+	//every thread counts, then parses, its own run of lines, the prefix sums over the counts say where each run's vertices and normals go
+	bool readFaces = normalIndex != nullptr || triangles != nullptr;
+	size_t numChunks = pool != nullptr ? size_t(pool->NumThreads()) : 1;
+	std::vector<OBJChunk> chunks(numChunks);
+	for (size_t k = 0; k < numChunks; k++) {
+		chunks[k].begin = k == 0 ? begin : chunks[k - 1].end;
+		const char* split = begin + file.Size() / numChunks * (k + 1);
+		chunks[k].end = k + 1 == numChunks ? end : std::max(chunks[k].begin, split == begin ? begin : NextLine(split - 1, end));	//just past the newline at or after the even split
+	}
+	auto forChunks = [&](const std::function<void(size_t)>& body) {
+		auto range = [&](size_t first, size_t last) { for (size_t k = first; k < last; k++) { body(k); } };
+		if (pool != nullptr) { pool->ParallelFor(numChunks, range, 1); }
+		else { range(0, numChunks); }
+	};
+
+	std::atomic<size_t> firstCut(numChunks);
+	forChunks([&](size_t k) { CountChunk(&chunks[k], k, readFaces, &firstCut); });
+	numChunks = std::min(numChunks, firstCut.load() + 1);	//the vt cutoff, chunk firstCut stops at its vt line and the ones after it don't count
+	chunks.resize(numChunks);
+	size_t firstVertex = vertices->size(), firstNormal = normals->size();	//face indices are relative to this file
+	size_t numVertices = 0, numNormals = 0;
+	for (OBJChunk& chunk : chunks) {
+		chunk.firstVertex = numVertices;
+		chunk.firstNormal = numNormals;
+		numVertices += chunk.numVertices;
+		numNormals += chunk.numNormals;
+	}
+	vertices->resize(firstVertex + numVertices);
+	normals->resize(firstNormal + numNormals);
+	forChunks([&](size_t k) { ParseChunk(&chunks[k], readFaces, triangles != nullptr, firstVertex, vertices->data() + firstVertex, normals->data() + firstNormal); });
+
+	bool gaps = false;	//a line that didn't parse shifts every index after it, which the later chunks couldn't know about
+	for (const OBJChunk& chunk : chunks) { gaps = gaps || chunk.parsedVertices != chunk.numVertices || chunk.parsedNormals != chunk.numNormals; }
+	if (gaps) {
+		if (chunks.size() > 1) {	//rare enough that going over the whole file again on one thread is fine
+			OBJChunk whole;
+			whole.begin = chunks.front().begin;
+			whole.end = chunks.back().end;
+			chunks.assign(1, std::move(whole));
+			ParseChunk(&chunks[0], readFaces, triangles != nullptr, firstVertex, vertices->data() + firstVertex, normals->data() + firstNormal);
+		}
+		vertices->resize(firstVertex + chunks[0].parsedVertices);	//a single chunk only writes the lines that parsed, back to back
+		normals->resize(firstNormal + chunks[0].parsedNormals);
+	}
+
+	if (triangles != nullptr) {	//faces that point at vertices that never showed up
+		for (const OBJChunk& chunk : chunks) {
+			for (size_t t = 0; t + 3 <= chunk.triangles.size(); t += 3) {
+				if (chunk.triangles[t] >= vertices->size() || chunk.triangles[t + 1] >= vertices->size() || chunk.triangles[t + 2] >= vertices->size()) { continue; }
+				triangles->insert(triangles->end(), chunk.triangles.begin() + ptrdiff_t(t), chunk.triangles.begin() + ptrdiff_t(t + 3));
 			}
-			else if (line.substr(0, 2) == "vt") { break; }	//we don't care about anything beyond the vertices and normals, no point reading stuff we're not going to use
 		}
-		file.close();
 	}
-	else { std::cout << "Invalid file\n"; }
+	if (normalIndex == nullptr) { return; }
+
+	//turn the face records into one normal index per vertex, vertices no face gave a normal keep the one at their own position
+	size_t fileVertices = vertices->size() - firstVertex, fileNormals = normals->size() - firstNormal;
+	if (fileNormals == 0) { return; }
+	std::vector<uint32_t> faceNormals(fileVertices, UINT32_MAX);	//normal per vertex of this file as the f records say, UINT32_MAX where none did
+	size_t conflicts = 0;
+	for (const OBJChunk& chunk : chunks) {	//in file order, so it's still the first face that gets to claim a vertex
+		for (size_t c = 0; c + 2 <= chunk.corners.size(); c += 2) {
+			if (chunk.corners[c] >= fileVertices) { continue; }
+			uint32_t& slot = faceNormals[chunk.corners[c]];
+			if (slot != UINT32_MAX && slot != chunk.corners[c + 1]) { conflicts++; continue; }	//a vertex can only refract through one normal, the first face to claim it wins
+			slot = chunk.corners[c + 1];
+		}
+	}
+	bool identity = fileVertices == fileNormals;
+	size_t missing = 0;
+	for (size_t i = 0; i < fileVertices; i++) {
+		if (faceNormals[i] == UINT32_MAX || faceNormals[i] >= fileNormals) {
+			if (i >= fileNormals) { missing++; }
+			faceNormals[i] = i < fileNormals ? uint32_t(i) : 0;
+		}
+		identity = identity && faceNormals[i] == i;
+	}
+	if (conflicts > 0) { std::cout << conflicts << " face corners gave a vertex a second normal, kept the first one\n"; }
+	if (missing > 0) { std::cout << missing << " vertices have no normal\n"; }
+
+	if (identity && normalIndex->empty()) { return; }	//the normals line up with the vertices anyway, the kernels can skip the indirection
+	if (normalIndex->empty()) {	//earlier files paired one to one, spell that out before appending
+		normalIndex->resize(firstVertex);
+		for (size_t i = 0; i < firstVertex; i++) { (*normalIndex)[i] = uint32_t(i); }
+	}
+	for (uint32_t& index : faceNormals) { index += uint32_t(firstNormal); }
+	normalIndex->insert(normalIndex->end(), faceNormals.begin(), faceNormals.end());
+}
+
+OBJReader::OBJReader(const std::string& objFilePath) : file(objFilePath) {
+	if (!file.IsOpen()) { std::cout << "Invalid file\n"; return; }
+	vertexCursor = file.Data();
+	end = file.Data() + file.Size();
+
+	//the normal cursor starts at the first vn line, found once here with a bare prefix scan, so Read never has to walk the v block with it
+	//the pages go again as the scan passes them, the vertex cursor faults them back in a chunk at a time, so this never holds more than a window of the file either
+	const size_t window = size_t(1) << 26;
+	size_t discarded = 0;
+	for (const char* line = file.Data(); line < end; line = NextLine(line, end)) {
+		if (end - line >= 3 && line[0] == 'v' && line[1] == 'n' && (line[2] == ' ' || line[2] == '\t')) { normalCursor = line; break; }
+		if (end - line >= 2 && line[0] == 'v' && line[1] == 't') { break; }	//same cutoff as Next, no normals to pair with
+		size_t offset = size_t(line - file.Data());
+		if (offset - discarded >= window) { file.Discard(discarded, offset); discarded = offset; }
+	}
+	if (normalCursor == nullptr) { vertexCursor = nullptr; }	//nothing to pair, the first Read returns 0
+	else { file.Discard(discarded, size_t(normalCursor - file.Data())); }
+}
+
+const char* OBJReader::Next(const char* cursor, char kind, Eigen::Vector3d* value) const {
+	while (cursor != nullptr && cursor < end) {
+		const char* next = NextLine(cursor, end);
+		if (next - cursor >= 2 && cursor[0] == 'v') {
+			if (cursor[1] == 't') { return nullptr; }	//same cutoff as ParseOBJ, nothing we use comes after the texture coordinates
+			if (cursor[1] == kind && ParseVector3(cursor + 2, next, value)) { return next; }
+		}
+		cursor = next;
+	}
+	return nullptr;
+}
+
+size_t OBJReader::Read(size_t maxVertices, std::vector<Eigen::Vector3d>* vertices, std::vector<Eigen::Vector3d>* normals) {
+	vertices->clear();
+	normals->clear();
+	const char* vertexStart = vertexCursor;
+	const char* normalStart = normalCursor;
+	Eigen::Vector3d vertex, normal;
+	while (vertices->size() < maxVertices && vertexCursor != nullptr && normalCursor != nullptr) {
+		const char* nextVertex = Next(vertexCursor, ' ', &vertex);
+		const char* nextNormal = Next(normalCursor, 'n', &normal);
+		if (nextVertex == nullptr || nextNormal == nullptr) { vertexCursor = normalCursor = nullptr; break; }
+		vertices->push_back(vertex);
+		normals->push_back(normal);
+		vertexCursor = nextVertex;
+		normalCursor = nextNormal;
+	}
+	if (vertexStart != nullptr) {	//each cursor is done with what it walked over, the v and vn blocks get released separately as the two cursors move through them
+		auto offset = [&](const char* cursor) { return cursor == nullptr ? file.Size() : size_t(cursor - file.Data()); };
+		file.Discard(offset(vertexStart), offset(vertexCursor));
+		file.Discard(offset(normalStart), offset(normalCursor));
+	}
+	return vertices->size();
 }
 
-void Refract(std::vector<Eigen::Vector3d> normals, std::vector<Eigen::Vector3d>* refracteds, double eta) {	//computes refracted light vectors from incident and normal vectors, reference https://graphics.stanford.edu/courses/cs148-10-summer/docs/2006--degreve--reflection_refraction.pdf
+void Refract(const std::vector<Eigen::Vector3d>& normals, std::vector<Eigen::Vector3d>* refracteds, double eta) {
+	refracteds->resize(normals.size());
+	Refract(std::span<const Eigen::Vector3d>(normals), std::span<Eigen::Vector3d>(*refracteds), eta);
+}
+
+void Refract(std::span<const Eigen::Vector3d> normals, std::span<Eigen::Vector3d> refracteds, double eta) {	//computes refracted light vectors from incident and normal vectors, reference https://graphics.stanford.edu/courses/cs148-10-summer/docs/2006--degreve--reflection_refraction.pdf
 
 	int numPoints = int(normals.size());		//vertices, normals, and refracteds will all have the same number of elements
 	Eigen::Vector3d incident(0, 0, 1);			//assume light always arrives at the interface pointing in the positive z direction
-	Eigen::Vector3d TIR(.9999, 0, 0.0141418);	//in the case of total internal reflection, shoot the light way off to the side in an arbitrary direction so that it doesn't show up on the part of the screen we see
 
 	for (int i = 0; i < numPoints; i++) {
 		double cosIncidenceAngle = normals[i].z();	//incident dot normal = 0*Nx + 0*Ny + 1*Nz = Nz
 		double sinRefractedAngle2 = eta * eta * (1 - cosIncidenceAngle * cosIncidenceAngle);	//eta1/eta2 = eta1 = eta, since the second medium is just air with eta2 = 1
 		
 		if (sinRefractedAngle2 <= 1) {		//check for total interal reflection
-			Eigen::Vector3d refracted = eta * incident - (eta * cosIncidenceAngle - sqrtl(1 - sinRefractedAngle2)) * normals[i];
-			refracteds->push_back(refracted);
+			refracteds[i] = eta * incident - (eta * cosIncidenceAngle - std::sqrt(1 - sinRefractedAngle2)) * normals[i];
 		}
 		else
 		{
-			refracteds->push_back(TIR);		//out of sight, out of mind :)
+			refracteds[i] = TIR;		//out of sight, out of mind :)
 		}									
 	}
 }
 
-void CalculateIntersections(std::vector<Eigen::Vector3d> vertices, std::vector<Eigen::Vector3d> refracteds, std::vector<Eigen::Vector2d>* intersections, double receiver_plane) {	//returns the points on the receiver plane where the light rays from each vertex intersect
+template <typename S, bool gathered, typename T>
+static typename S::Reg LoadNormal(const T* component, const uint32_t* normalIndex, size_t i) {	//normal component of rays [i, i + S::width), straight from the array or through the per-vertex normal index
+	if constexpr (gathered) { return S::Gather(component, normalIndex + i); }
+	else { return S::Load(component + i); }
+}
+
+template <typename S, bool gathered, typename T>
+static size_t RefractLanes(const T* nx, const T* ny, const T* nz, const uint32_t* normalIndex, T* rx, T* ry, T* rz, T* irz, size_t i, size_t numPoints, T eta) {	//refracts S::width rays at a time starting from i, returns the first index it didn't get to
+	using Reg = typename S::Reg;
+	const Reg etaV = S::Set1(eta), eta2 = S::Set1(eta * eta), one = S::Set1(T(1)), zero = S::Set1(T(0));
+	const Reg tirX = S::Set1(T(TIR.x())), tirY = S::Set1(T(TIR.y())), tirZ = S::Set1(T(TIR.z()));
+
+	for (; i + S::width <= numPoints; i += S::width) {
+		Reg cosIncidenceAngle = LoadNormal<S, gathered>(nz, normalIndex, i);	//same as Refract, incident is (0, 0, 1) so the dot product is just Nz
+		Reg sinRefractedAngle2 = S::Mul(eta2, S::Sub(one, S::Mul(cosIncidenceAngle, cosIncidenceAngle)));
+		typename S::Mask refracts = S::LessEqual(sinRefractedAngle2, one);	//lanes that don't hit total internal reflection
+
+		Reg cosRefractedAngle = S::Sqrt(S::Max(S::Sub(one, sinRefractedAngle2), zero));	//clamped so the TIR lanes don't produce NaNs, they get replaced below anyway
+		Reg k = S::Sub(S::Mul(etaV, cosIncidenceAngle), cosRefractedAngle);	//refracted = eta * incident - k * normal
+
+		S::Store(rx + i, S::Select(refracts, S::Mul(k, S::Sub(zero, LoadNormal<S, gathered>(nx, normalIndex, i))), tirX));
+		S::Store(ry + i, S::Select(refracts, S::Mul(k, S::Sub(zero, LoadNormal<S, gathered>(ny, normalIndex, i))), tirY));
+		Reg z = S::Select(refracts, S::Sub(etaV, S::Mul(k, cosIncidenceAngle)), tirZ);
+		S::Store(rz + i, z);
+		S::Store(irz + i, S::Div(one, z));
+	}
+	return i;
+}
+
+template <typename T>
+void RefractRays(std::span<const T> nx, std::span<const T> ny, std::span<const T> nz, std::span<T> rx, std::span<T> ry, std::span<T> rz, std::span<T> irz, T eta) {
+	size_t numPoints = nx.size();
+	size_t i = RefractLanes<Simd<T>, false>(nx.data(), ny.data(), nz.data(), nullptr, rx.data(), ry.data(), rz.data(), irz.data(), 0, numPoints, eta);
+	RefractLanes<SimdScalar<T>, false>(nx.data(), ny.data(), nz.data(), nullptr, rx.data(), ry.data(), rz.data(), irz.data(), i, numPoints, eta);	//leftovers that don't fill a whole register
+}
+
+template <typename T>
+void RefractRays(std::span<const T> nx, std::span<const T> ny, std::span<const T> nz, std::span<const uint32_t> normalIndex, std::span<T> rx, std::span<T> ry, std::span<T> rz, std::span<T> irz, T eta) {
+	size_t numPoints = normalIndex.size();
+	size_t i = RefractLanes<Simd<T>, true>(nx.data(), ny.data(), nz.data(), normalIndex.data(), rx.data(), ry.data(), rz.data(), irz.data(), 0, numPoints, eta);
+	RefractLanes<SimdScalar<T>, true>(nx.data(), ny.data(), nz.data(), normalIndex.data(), rx.data(), ry.data(), rz.data(), irz.data(), i, numPoints, eta);
+}
+
+template <typename T>
+void RefractRays(RayBuffer<T>* rays, T eta, ThreadPool* pool) {
+	PROFILE_SCOPE("refract");
+	PROFILE_COUNT("rays", rays->Size());
+	auto refract = [&](size_t begin, size_t end) {
+		size_t n = end - begin;
+		if (!rays->normalIndex.empty()) {	//shared normals, every chunk can gather from any of them
+			RefractRays<T>(rays->nx, rays->ny, rays->nz, rays->normalIndex.subspan(begin, n),
+				std::span<T>(rays->rx).subspan(begin, n), std::span<T>(rays->ry).subspan(begin, n), std::span<T>(rays->rz).subspan(begin, n), std::span<T>(rays->irz).subspan(begin, n), eta);
+			return;
+		}
+		RefractRays<T>(std::span<const T>(rays->nx).subspan(begin, n), std::span<const T>(rays->ny).subspan(begin, n), std::span<const T>(rays->nz).subspan(begin, n),
+			std::span<T>(rays->rx).subspan(begin, n), std::span<T>(rays->ry).subspan(begin, n), std::span<T>(rays->rz).subspan(begin, n), std::span<T>(rays->irz).subspan(begin, n), eta);
+	};
+	if (pool != nullptr) { pool->ParallelFor(rays->Size(), refract); }
+	else { refract(0, rays->Size()); }
+}
+
+template void RefractRays<float>(std::span<const float>, std::span<const float>, std::span<const float>, std::span<float>, std::span<float>, std::span<float>, std::span<float>, float);
+template void RefractRays<double>(std::span<const double>, std::span<const double>, std::span<const double>, std::span<double>, std::span<double>, std::span<double>, std::span<double>, double);
+template void RefractRays<float>(std::span<const float>, std::span<const float>, std::span<const float>, std::span<const uint32_t>, std::span<float>, std::span<float>, std::span<float>, std::span<float>, float);
+template void RefractRays<double>(std::span<const double>, std::span<const double>, std::span<const double>, std::span<const uint32_t>, std::span<double>, std::span<double>, std::span<double>, std::span<double>, double);
+template void RefractRays<float>(RayBuffer<float>*, float, ThreadPool*);
+template void RefractRays<double>(RayBuffer<double>*, double, ThreadPool*);
+
+template <typename S, typename T>
+static size_t IntersectLanes(const T* vx, const T* vy, const T* vz, const T* rx, const T* ry, const T* irz, T* ix, T* iy, size_t i, size_t numPoints, T receiver_plane) {
+	using Reg = typename S::Reg;
+	const Reg plane = S::Set1(receiver_plane), scale = S::Set1(T(targetScale));
+
+	for (; i + S::width <= numPoints; i += S::width) {
+		Reg t = S::Mul(S::Sub(plane, S::Load(vz + i)), S::Load(irz + i));	//solve for t in vertex.z + ray.z*t = receiever_plane.z, with the divide already done by RefractRays
+		S::Store(ix + i, S::MulAdd(S::MulAdd(S::Load(rx + i), t, S::Load(vx + i)), scale, scale));	//hit point and the transform into the 256x256 target image in one go
+		S::Store(iy + i, S::MulAdd(S::MulAdd(S::Load(ry + i), t, S::Load(vy + i)), scale, scale));
+	}
+	return i;
+}
+
+template <typename T>
+void IntersectRays(std::span<const T> vx, std::span<const T> vy, std::span<const T> vz, std::span<const T> rx, std::span<const T> ry, std::span<const T> irz, std::span<T> ix, std::span<T> iy, T receiver_plane) {
+	size_t numPoints = vx.size();
+	size_t i = IntersectLanes<Simd<T>>(vx.data(), vy.data(), vz.data(), rx.data(), ry.data(), irz.data(), ix.data(), iy.data(), 0, numPoints, receiver_plane);
+	IntersectLanes<SimdScalar<T>>(vx.data(), vy.data(), vz.data(), rx.data(), ry.data(), irz.data(), ix.data(), iy.data(), i, numPoints, receiver_plane);
+}
+
+template <typename T>
+void IntersectRays(const RayBuffer<T>& rays, std::span<T> ix, std::span<T> iy, T receiver_plane, ThreadPool* pool) {
+	auto intersect = [&](size_t begin, size_t end) {
+		size_t n = end - begin;
+		IntersectRays<T>(std::span<const T>(rays.vx).subspan(begin, n), std::span<const T>(rays.vy).subspan(begin, n), std::span<const T>(rays.vz).subspan(begin, n),
+			std::span<const T>(rays.rx).subspan(begin, n), std::span<const T>(rays.ry).subspan(begin, n), std::span<const T>(rays.irz).subspan(begin, n), ix.subspan(begin, n), iy.subspan(begin, n), receiver_plane);
+	};
+	if (pool != nullptr) { pool->ParallelFor(rays.Size(), intersect); }
+	else { intersect(0, rays.Size()); }
+}
+
+template void IntersectRays<float>(std::span<const float>, std::span<const float>, std::span<const float>, std::span<const float>, std::span<const float>, std::span<const float>, std::span<float>, std::span<float>, float);
+template void IntersectRays<double>(std::span<const double>, std::span<const double>, std::span<const double>, std::span<const double>, std::span<const double>, std::span<const double>, std::span<double>, std::span<double>, double);
+template void IntersectRays<float>(const RayBuffer<float>&, std::span<float>, std::span<float>, float, ThreadPool*);
+template void IntersectRays<double>(const RayBuffer<double>&, std::span<double>, std::span<double>, double, ThreadPool*);
+
+template <typename S, typename T>
+static size_t PrepareLanes(const T* vx, const T* vy, const T* vz, const T* rx, const T* ry, const T* irz, T* baseX, T* baseY, T* slopeX, T* slopeY, size_t i, size_t numPoints) {
+	using Reg = typename S::Reg;
+	const Reg scale = S::Set1(T(targetScale));
+
+	for (; i + S::width <= numPoints; i += S::width) {	//ix = (vx + rx * (d - vz) / rz) * scale + scale, split into the part that depends on d and the part that doesn't
+		Reg z = S::Load(vz + i), inverseZ = S::Load(irz + i);
+		Reg sx = S::Mul(S::Mul(S::Load(rx + i), inverseZ), scale);
+		Reg sy = S::Mul(S::Mul(S::Load(ry + i), inverseZ), scale);
+		S::Store(slopeX + i, sx);
+		S::Store(slopeY + i, sy);
+		S::Store(baseX + i, S::Sub(S::MulAdd(S::Load(vx + i), scale, scale), S::Mul(sx, z)));
+		S::Store(baseY + i, S::Sub(S::MulAdd(S::Load(vy + i), scale, scale), S::Mul(sy, z)));
+	}
+	return i;
+}
+
+template <typename T>
+void TriangleFlux(const RayBuffer<T>& rays, std::span<T> flux, ThreadPool* pool) {
+	auto area = [&](size_t begin, size_t end) {
+		for (size_t t = begin; t < end; t++) {
+			uint32_t a = rays.triangles[3 * t], b = rays.triangles[3 * t + 1], c = rays.triangles[3 * t + 2];
+			T cross = (rays.vx[b] - rays.vx[a]) * (rays.vy[c] - rays.vy[a]) - (rays.vx[c] - rays.vx[a]) * (rays.vy[b] - rays.vy[a]);
+			flux[t] = std::abs(cross) * T(0.5 * targetScale * targetScale);
+		}
+	};
+	if (pool != nullptr) { pool->ParallelFor(flux.size(), area); }
+	else { area(0, flux.size()); }
+}
+
+template void TriangleFlux<float>(const RayBuffer<float>&, std::span<float>, ThreadPool*);
+template void TriangleFlux<double>(const RayBuffer<double>&, std::span<double>, ThreadPool*);
+
+template <typename T>
+void PrepareIntersections(const RayBuffer<T>& rays, IntersectionCache<T>* cache, ThreadPool* pool) {
+	cache->Resize(rays.Size());
+	auto prepare = [&](size_t begin, size_t end) {
+		size_t i = PrepareLanes<Simd<T>>(rays.vx.data(), rays.vy.data(), rays.vz.data(), rays.rx.data(), rays.ry.data(), rays.irz.data(), cache->baseX.data(), cache->baseY.data(), cache->slopeX.data(), cache->slopeY.data(), begin, end);
+		PrepareLanes<SimdScalar<T>>(rays.vx.data(), rays.vy.data(), rays.vz.data(), rays.rx.data(), rays.ry.data(), rays.irz.data(), cache->baseX.data(), cache->baseY.data(), cache->slopeX.data(), cache->slopeY.data(), i, end);
+	};
+	if (pool != nullptr) { pool->ParallelFor(rays.Size(), prepare); }
+	else { prepare(0, rays.Size()); }
+}
+
+enum LightPath { lightAlongZ, lightCollimated, lightPoint };	//compile time choice of how LightLanes gets the incident direction
+
+template <typename S, LightPath path, bool gathered, typename T>
+static size_t LightLanes(const RayBuffer<T>& rays, const Light& light, T eta, T* baseX, T* baseY, T* slopeX, T* slopeY, size_t i, size_t numPoints) {	//RefractLanes and PrepareLanes in one go for any light, returns the first index it didn't get to
+	using Reg = typename S::Reg;
+	const Reg etaV = S::Set1(eta), eta2 = S::Set1(eta * eta), one = S::Set1(T(1)), zero = S::Set1(T(0)), scale = S::Set1(T(targetScale));
+	const Reg tirX = S::Set1(T(TIR.x())), tirY = S::Set1(T(TIR.y())), tirZ = S::Set1(T(TIR.z()));
+	const Reg lightX = S::Set1(T(path == lightPoint ? light.position.x() : light.direction.x()));
+	const Reg lightY = S::Set1(T(path == lightPoint ? light.position.y() : light.direction.y()));
+	const Reg lightZ = S::Set1(T(path == lightPoint ? light.position.z() : light.direction.z()));
+	const uint32_t* normalIndex = rays.normalIndex.data();
+
+	for (; i + S::width <= numPoints; i += S::width) {
+		Reg px = S::Load(rays.vx.data() + i), py = S::Load(rays.vy.data() + i), pz = S::Load(rays.vz.data() + i);
+		Reg mx = LoadNormal<S, gathered>(rays.nx.data(), normalIndex, i), my = LoadNormal<S, gathered>(rays.ny.data(), normalIndex, i), mz = LoadNormal<S, gathered>(rays.nz.data(), normalIndex, i);
+		Reg x, y, z;
+		if constexpr (path == lightAlongZ) {	//exactly the RefractLanes math, incident is (0, 0, 1) so the dot product is just Nz
+			Reg cosIncidenceAngle = mz;
+			Reg sinRefractedAngle2 = S::Mul(eta2, S::Sub(one, S::Mul(cosIncidenceAngle, cosIncidenceAngle)));
+			typename S::Mask refracts = S::LessEqual(sinRefractedAngle2, one);
+			Reg k = S::Sub(S::Mul(etaV, cosIncidenceAngle), S::Sqrt(S::Max(S::Sub(one, sinRefractedAngle2), zero)));
+			x = S::Select(refracts, S::Mul(k, S::Sub(zero, mx)), tirX);
+			y = S::Select(refracts, S::Mul(k, S::Sub(zero, my)), tirY);
+			z = S::Select(refracts, S::Sub(etaV, S::Mul(k, cosIncidenceAngle)), tirZ);
+		}
+		else {
+			Reg ix = lightX, iy = lightY, iz = lightZ;
+			if constexpr (path == lightPoint) {	//from the light to the vertex
+				ix = S::Sub(px, lightX); iy = S::Sub(py, lightY); iz = S::Sub(pz, lightZ);
+				Reg inverseLength = S::Div(one, S::Sqrt(S::MulAdd(ix, ix, S::MulAdd(iy, iy, S::Mul(iz, iz)))));
+				ix = S::Mul(ix, inverseLength); iy = S::Mul(iy, inverseLength); iz = S::Mul(iz, inverseLength);
+			}
+			Reg cosIncidenceAngle = S::MulAdd(ix, mx, S::MulAdd(iy, my, S::Mul(iz, mz)));
+			typename S::Mask facing = S::LessEqual(zero, cosIncidenceAngle);	//a normal pointing back at the light gets flipped so the formula sees the side the light comes from
+			mx = S::Select(facing, mx, S::Sub(zero, mx)); my = S::Select(facing, my, S::Sub(zero, my)); mz = S::Select(facing, mz, S::Sub(zero, mz));
+			cosIncidenceAngle = S::Select(facing, cosIncidenceAngle, S::Sub(zero, cosIncidenceAngle));
+			Reg sinRefractedAngle2 = S::Mul(eta2, S::Sub(one, S::Mul(cosIncidenceAngle, cosIncidenceAngle)));
+			typename S::Mask refracts = S::LessEqual(sinRefractedAngle2, one);
+			Reg k = S::Sub(S::Mul(etaV, cosIncidenceAngle), S::Sqrt(S::Max(S::Sub(one, sinRefractedAngle2), zero)));	//refracted = eta * incident - k * normal
+			x = S::Select(refracts, S::Sub(S::Mul(etaV, ix), S::Mul(k, mx)), tirX);
+			y = S::Select(refracts, S::Sub(S::Mul(etaV, iy), S::Mul(k, my)), tirY);
+			z = S::Select(refracts, S::Sub(S::Mul(etaV, iz), S::Mul(k, mz)), tirZ);
+		}
+
+		Reg inverseZ = S::Div(one, z);	//same as PrepareLanes from here on
+		Reg sx = S::Mul(S::Mul(x, inverseZ), scale);
+		Reg sy = S::Mul(S::Mul(y, inverseZ), scale);
+		S::Store(slopeX + i, sx);
+		S::Store(slopeY + i, sy);
+		S::Store(baseX + i, S::Sub(S::MulAdd(px, scale, scale), S::Mul(sx, pz)));
+		S::Store(baseY + i, S::Sub(S::MulAdd(py, scale, scale), S::Mul(sy, pz)));
+	}
+	return i;
+}
+
+template <LightPath path, bool gathered, typename T>
+static void PrepareLight(const RayBuffer<T>& rays, const Light& light, T eta, IntersectionCache<T>* cache, size_t offset, size_t begin, size_t end) {
+	T* baseX = cache->baseX.data() + offset, * baseY = cache->baseY.data() + offset, * slopeX = cache->slopeX.data() + offset, * slopeY = cache->slopeY.data() + offset;
+	size_t i = LightLanes<Simd<T>, path, gathered>(rays, light, eta, baseX, baseY, slopeX, slopeY, begin, end);
+	LightLanes<SimdScalar<T>, path, gathered>(rays, light, eta, baseX, baseY, slopeX, slopeY, i, end);
+}
+
+template <bool gathered, typename T>
+static void PrepareLight(const RayBuffer<T>& rays, const Light& light, T eta, IntersectionCache<T>* cache, size_t offset, size_t begin, size_t end) {	//picks the specialized kernel once per light, not per ray
+	if (light.IsAlongZ()) { PrepareLight<lightAlongZ, gathered>(rays, light, eta, cache, offset, begin, end); }
+	else if (light.kind == Light::point) { PrepareLight<lightPoint, gathered>(rays, light, eta, cache, offset, begin, end); }
+	else { PrepareLight<lightCollimated, gathered>(rays, light, eta, cache, offset, begin, end); }
+}
+
+template <typename T>
+void PrepareIntersections(const RayBuffer<T>& rays, std::span<const Light> lights, T eta, IntersectionCache<T>* cache, ThreadPool* pool) {
+	PROFILE_SCOPE("prepare");
+	size_t numPoints = rays.Size();
+	PROFILE_COUNT("rays", numPoints * lights.size());
+	PROFILE_COUNT("bytes", numPoints * (6 + 4 * lights.size()) * sizeof(T));
+	cache->Resize(numPoints * lights.size());
+	auto prepare = [&](size_t begin, size_t end) {
+		const size_t blockSize = 1024;	//every light goes over the same block while its vertices and normals are still in L1, instead of one pass over the mesh per light
+		for (size_t block = begin; block < end; block += blockSize) {
+			size_t blockEnd = std::min(block + blockSize, end);
+			for (size_t k = 0; k < lights.size(); k++) {
+				if (rays.normalIndex.empty()) { PrepareLight<false>(rays, lights[k], eta, cache, k * numPoints, block, blockEnd); }
+				else { PrepareLight<true>(rays, lights[k], eta, cache, k * numPoints, block, blockEnd); }
+			}
+		}
+	};
+	if (pool != nullptr) { pool->ParallelFor(numPoints, prepare); }
+	else { prepare(0, numPoints); }
+	PROFILE_COUNT("tir rays", CountTIR(*cache));
+}
+
+static bool RefractDirection(const Eigen::Vector3d& incident, Eigen::Vector3d normal, double ratio, Eigen::Vector3d* refracted) {	//ratio is the index the light comes from over the one it goes into, false on total internal reflection
+	normal.normalize();
+	double cosIncidenceAngle = -normal.dot(incident);
+	if (cosIncidenceAngle < 0) { normal = -normal; cosIncidenceAngle = -cosIncidenceAngle; }	//either orientation of the surface works
+	double cosRefractedAngle2 = 1 - ratio * ratio * (1 - cosIncidenceAngle * cosIncidenceAngle);
+	if (cosRefractedAngle2 < 0) { return false; }
+	*refracted = ratio * incident + (ratio * cosIncidenceAngle - std::sqrt(cosRefractedAngle2)) * normal;
+	return true;
+}
+
+static Eigen::Vector3d SurfaceNormal(const RayBuffer<double>& surface, const SurfaceHit& hit) {	//interpolated from the corners, or the flat normal of the triangle when the surface came without normals
+	uint32_t corners[3] = { surface.triangles[3 * size_t(hit.triangle)], surface.triangles[3 * size_t(hit.triangle) + 1], surface.triangles[3 * size_t(hit.triangle) + 2] };
+	double weights[3] = { 1 - hit.u - hit.v, hit.u, hit.v };
+	Eigen::Vector3d normal = Eigen::Vector3d::Zero();
+	for (int k = 0; k < 3 && surface.NumNormals() > 0; k++) {
+		size_t n = surface.normalIndex.empty() ? corners[k] : surface.normalIndex[corners[k]];
+		normal += weights[k] * Eigen::Vector3d(surface.nx[n], surface.ny[n], surface.nz[n]);
+	}
+	if (normal.squaredNorm() > 1e-12) { return normal; }
+	auto corner = [&](int k) { return Eigen::Vector3d(surface.vx[corners[k]], surface.vy[corners[k]], surface.vz[corners[k]]); };
+	return (corner(1) - corner(0)).cross(corner(2) - corner(0));
+}
+
+void PrepareIntersections(const RayBuffer<double>& rays, std::span<const Light> lights, double eta, const RayBuffer<double>& exitSurface, const TriangleBVH& exitBVH, IntersectionCache<double>* cache, ThreadPool* pool) {	//one ray at a time, the BVH walk doesn't vectorize, but it only runs when the mesh or lights change
+	PROFILE_SCOPE("prepare two surfaces");
+	size_t numPoints = rays.Size();
+	PROFILE_COUNT("rays", numPoints * lights.size());
+	cache->Resize(numPoints * lights.size());
+	auto prepare = [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			size_t n = rays.normalIndex.empty() ? i : rays.normalIndex[i];
+			Eigen::Vector3d vertex(rays.vx[i], rays.vy[i], rays.vz[i]), normal(rays.nx[n], rays.ny[n], rays.nz[n]);
+			for (size_t k = 0; k < lights.size(); k++) {
+				Eigen::Vector3d incident = lights[k].kind == Light::point ? Eigen::Vector3d((vertex - lights[k].position).normalized()) : lights[k].direction;
+				Eigen::Vector3d inside, leaving, exit = vertex;
+				SurfaceHit hit;
+				bool through = RefractDirection(incident, normal, 1 / eta, &inside) && exitBVH.Intersect(vertex, inside, &hit);
+				if (through) { exit = vertex + hit.t * inside; }
+				through = through && RefractDirection(inside, SurfaceNormal(exitSurface, hit), eta, &leaving) && leaving.z() > 0;	//going back towards the light never reaches the wall either
+				if (!through) { leaving = TIR; }
+
+				size_t j = k * numPoints + i;
+				double inverseZ = 1 / leaving.z();	//multiplied like the SIMD kernels do it, so lost rays get the same slope everywhere
+				cache->slopeX[j] = leaving.x() * inverseZ * targetScale;
+				cache->slopeY[j] = leaving.y() * inverseZ * targetScale;
+				cache->baseX[j] = exit.x() * targetScale + targetScale - cache->slopeX[j] * exit.z();
+				cache->baseY[j] = exit.y() * targetScale + targetScale - cache->slopeY[j] * exit.z();
+			}
+		}
+	};
+	if (pool != nullptr) { pool->ParallelFor(numPoints, prepare); }
+	else { prepare(0, numPoints); }
+	PROFILE_COUNT("tir rays", CountTIR(*cache));
+}
+
+template <typename S, typename T>
+static size_t HeightfieldLanes(const T* xs, const T* row, ptrdiff_t left, ptrdiff_t right, const T* above, const T* below, T inverseDx, T inverseDy, T y, T eta, T* baseX, T* baseY, T* slopeX, T* slopeY, size_t c, size_t end) {	//columns [c, end) of one row, the slopes are (row[c + right] - row[c + left]) * inverseDx and (below - above) * inverseDy
+	using Reg = typename S::Reg;
+	const Reg etaV = S::Set1(eta), eta2 = S::Set1(eta * eta), one = S::Set1(T(1)), zero = S::Set1(T(0)), scale = S::Set1(T(targetScale));
+	const Reg tirX = S::Set1(T(TIR.x())), tirY = S::Set1(T(TIR.y())), tirZ = S::Set1(T(TIR.z()));
+	const Reg ddx = S::Set1(inverseDx), ddy = S::Set1(inverseDy), py = S::Set1(y);
+
+	for (; c + S::width <= end; c += S::width) {
+		Reg gx = S::Mul(S::Sub(S::Load(row + (c + right)), S::Load(row + (c + left))), ddx);
+		Reg gy = S::Mul(S::Sub(S::Load(below + c), S::Load(above + c)), ddy);
+		Reg cosIncidenceAngle = S::Div(one, S::Sqrt(S::MulAdd(gx, gx, S::MulAdd(gy, gy, one))));	//normal is (-gx, -gy, 1) normalized, so Nz is one over its length
+		Reg sinRefractedAngle2 = S::Mul(eta2, S::Sub(one, S::Mul(cosIncidenceAngle, cosIncidenceAngle)));
+		typename S::Mask refracts = S::LessEqual(sinRefractedAngle2, one);
+		Reg k = S::Mul(S::Sub(S::Mul(etaV, cosIncidenceAngle), S::Sqrt(S::Max(S::Sub(one, sinRefractedAngle2), zero))), cosIncidenceAngle);	//k * normal is k * Nz * (-gx, -gy, 1)
+		Reg x = S::Select(refracts, S::Mul(k, gx), tirX);
+		Reg yy = S::Select(refracts, S::Mul(k, gy), tirY);
+		Reg z = S::Select(refracts, S::Sub(etaV, k), tirZ);
+
+		Reg px = S::Load(xs + c), pz = S::Load(row + c);
+		Reg inverseZ = S::Div(one, z);
+		Reg sx = S::Mul(S::Mul(x, inverseZ), scale);
+		Reg sy = S::Mul(S::Mul(yy, inverseZ), scale);
+		S::Store(slopeX + c, sx);
+		S::Store(slopeY + c, sy);
+		S::Store(baseX + c, S::Sub(S::MulAdd(px, scale, scale), S::Mul(sx, pz)));
+		S::Store(baseY + c, S::Sub(S::MulAdd(py, scale, scale), S::Mul(sy, pz)));
+	}
+	return c;
+}
+
+void PrepareIntersections(const Heightfield& field, double eta, IntersectionCache<double>* cache, ThreadPool* pool) {
+	PROFILE_SCOPE("prepare heightfield");
+	PROFILE_COUNT("rays", field.Size());
+	PROFILE_COUNT("bytes", field.Size() * 5 * sizeof(double));
+	size_t width = size_t(field.width);
+	double dx = 2.0 / (field.width - 1), dy = 2.0 / (field.height - 1);
+	std::vector<double> xs(width);
+	for (int c = 0; c < field.width; c++) { xs[c] = field.X(c); }
+	cache->Resize(field.Size());
+	auto prepare = [&](size_t begin, size_t end) {
+		for (size_t r = begin; r < end; r++) {
+			size_t up = r > 0 ? r - 1 : r, down = r + 1 < size_t(field.height) ? r + 1 : r;	//one sided differences along the edges
+			const double* row = field.heights.data() + r * width, * above = field.heights.data() + up * width, * below = field.heights.data() + down * width;
+			double inverseDy = 1 / (double(down - up) * dy), y = field.Y(int(r));
+			double* out[4] = { cache->baseX.data() + r * width, cache->baseY.data() + r * width, cache->slopeX.data() + r * width, cache->slopeY.data() + r * width };
+			auto lanes = [&](auto simd, ptrdiff_t left, ptrdiff_t right, double inverseDx, size_t c, size_t last) {
+				return HeightfieldLanes<decltype(simd)>(xs.data(), row, left, right, above, below, inverseDx, inverseDy, y, eta, out[0], out[1], out[2], out[3], c, last);
+			};
+			lanes(SimdScalar<double>(), 0, 1, 1 / dx, 0, 1);
+			size_t c = lanes(Simd<double>(), -1, 1, 1 / (2 * dx), 1, width - 1);
+			lanes(SimdScalar<double>(), -1, 1, 1 / (2 * dx), c, width - 1);
+			lanes(SimdScalar<double>(), -1, 0, 1 / dx, width - 1, width);
+		}
+	};
+	if (pool != nullptr) { pool->ParallelFor(size_t(field.height), prepare); }
+	else { prepare(0, size_t(field.height)); }
+	PROFILE_COUNT("tir rays", CountTIR(*cache));
+}
+
+template <typename T>
+size_t SpectralLanes() { return size_t(Simd<T>::width); }
+
+template <typename S, typename T>
+static void SpectrumLanes(const RayBuffer<T>& rays, std::span<const T> etas, IntersectionCache<T>* cache, size_t begin, size_t end) {	//the LightLanes math along +z turned sideways, every lane has the same vertex and normal but its own eta
+	using Reg = typename S::Reg;
+	const Reg one = S::Set1(T(1)), zero = S::Set1(T(0)), scale = S::Set1(T(targetScale));
+	const Reg tirX = S::Set1(T(TIR.x())), tirY = S::Set1(T(TIR.y())), tirZ = S::Set1(T(TIR.z()));
+	const size_t stride = etas.size();
+
+	for (size_t i = begin; i < end; i++) {
+		size_t n = rays.normalIndex.empty() ? i : rays.normalIndex[i];
+		const Reg px = S::Set1(rays.vx[i] * T(targetScale) + T(targetScale)), pz = S::Set1(rays.vz[i]);
+		const Reg py = S::Set1(rays.vy[i] * T(targetScale) + T(targetScale));
+		const Reg mx = S::Set1(-rays.nx[n]), my = S::Set1(-rays.ny[n]), cosIncidenceAngle = S::Set1(rays.nz[n]);
+		const Reg cos2 = S::Mul(cosIncidenceAngle, cosIncidenceAngle);
+		T* baseX = cache->baseX.data() + i * stride, * baseY = cache->baseY.data() + i * stride, * slopeX = cache->slopeX.data() + i * stride, * slopeY = cache->slopeY.data() + i * stride;
+		for (size_t k = 0; k < stride; k += S::width) {
+			Reg etaV = S::Load(etas.data() + k);
+			Reg sinRefractedAngle2 = S::Mul(S::Mul(etaV, etaV), S::Sub(one, cos2));
+			typename S::Mask refracts = S::LessEqual(sinRefractedAngle2, one);
+			Reg c = S::Sub(S::Mul(etaV, cosIncidenceAngle), S::Sqrt(S::Max(S::Sub(one, sinRefractedAngle2), zero)));
+			Reg x = S::Select(refracts, S::Mul(c, mx), tirX);
+			Reg y = S::Select(refracts, S::Mul(c, my), tirY);
+			Reg z = S::Select(refracts, S::Sub(etaV, S::Mul(c, cosIncidenceAngle)), tirZ);
+
+			Reg inverseZ = S::Div(one, z);
+			Reg sx = S::Mul(S::Mul(x, inverseZ), scale);
+			Reg sy = S::Mul(S::Mul(y, inverseZ), scale);
+			S::Store(slopeX + k, sx);
+			S::Store(slopeY + k, sy);
+			S::Store(baseX + k, S::Sub(px, S::Mul(sx, pz)));
+			S::Store(baseY + k, S::Sub(py, S::Mul(sy, pz)));
+		}
+	}
+}
+
+template <typename T>
+void PrepareSpectrum(const RayBuffer<T>& rays, std::span<const T> etas, IntersectionCache<T>* cache, ThreadPool* pool) {
+	PROFILE_SCOPE("prepare spectrum");
+	size_t numPoints = rays.Size();
+	if (etas.size() % SpectralLanes<T>() != 0) { std::cout << "The spectrum needs a multiple of " << SpectralLanes<T>() << " wavelengths\n"; cache->Resize(0); return; }
+	PROFILE_COUNT("rays", numPoints * etas.size());
+	PROFILE_COUNT("bytes", numPoints * (6 + 4 * etas.size()) * sizeof(T));
+	cache->Resize(numPoints * etas.size());
+	auto prepare = [&](size_t begin, size_t end) { SpectrumLanes<Simd<T>>(rays, etas, cache, begin, end); };
+	if (pool != nullptr) { pool->ParallelFor(numPoints, prepare); }
+	else { prepare(0, numPoints); }
+	PROFILE_COUNT("tir rays", CountTIR(*cache));
+}
+
+template <typename S, typename T>
+static size_t AffineLanes(const T* baseX, const T* baseY, const T* slopeX, const T* slopeY, T* ix, T* iy, size_t i, size_t numPoints, T receiver_plane) {
+	using Reg = typename S::Reg;
+	const Reg d = S::Set1(receiver_plane);
+
+	for (; i + S::width <= numPoints; i += S::width) {	//four loads, two FMAs and two stores per ray, this is bound by memory bandwidth, not math
+		S::Store(ix + i, S::MulAdd(S::Load(slopeX + i), d, S::Load(baseX + i)));
+		S::Store(iy + i, S::MulAdd(S::Load(slopeY + i), d, S::Load(baseY + i)));
+	}
+	return i;
+}
+
+template <typename T>
+void IntersectRays(const IntersectionCache<T>& cache, size_t begin, std::span<T> ix, std::span<T> iy, T receiver_plane) {
+	const T* baseX = cache.baseX.data() + begin, * baseY = cache.baseY.data() + begin, * slopeX = cache.slopeX.data() + begin, * slopeY = cache.slopeY.data() + begin;
+	size_t i = AffineLanes<Simd<T>>(baseX, baseY, slopeX, slopeY, ix.data(), iy.data(), 0, ix.size(), receiver_plane);
+	AffineLanes<SimdScalar<T>>(baseX, baseY, slopeX, slopeY, ix.data(), iy.data(), i, ix.size(), receiver_plane);
+}
+
+template <typename T>
+void IntersectRays(const IntersectionCache<T>& cache, std::span<T> ix, std::span<T> iy, T receiver_plane, ThreadPool* pool) {
+	PROFILE_SCOPE("intersect");
+	PROFILE_COUNT("rays", cache.Size());
+	PROFILE_COUNT("bytes", cache.Size() * 6 * sizeof(T));
+	auto intersect = [&](size_t begin, size_t end) { IntersectRays<T>(cache, begin, ix.subspan(begin, end - begin), iy.subspan(begin, end - begin), receiver_plane); };
+	if (pool != nullptr) { pool->ParallelFor(cache.Size(), intersect); }
+	else { intersect(0, cache.Size()); }
+}
+
+template <typename T>
+void IntersectPreview(const IntersectionCache<T>& cache, size_t stride, std::span<T> ix, std::span<T> iy, T receiver_plane, ThreadPool* pool) {
+	PROFILE_SCOPE("intersect preview");
+	PROFILE_COUNT("rays", ix.size());
+	auto intersect = [&](size_t begin, size_t end) {
+		for (size_t j = begin, i = begin * stride; j < end; j++, i += stride) {	//the rays are a cache line or more apart, so this is bound by the loads and gathering them into registers wouldn't buy anything
+			ix[j] = cache.slopeX[i] * receiver_plane + cache.baseX[i];
+			iy[j] = cache.slopeY[i] * receiver_plane + cache.baseY[i];
+		}
+	};
+	if (pool != nullptr) { pool->ParallelFor(ix.size(), intersect); }
+	else { intersect(0, ix.size()); }
+}
+
+template <typename T>
+void IntersectSweep(const IntersectionCache<T>& cache, std::span<const T> distances, std::span<T> ix, std::span<T> iy, ThreadPool* pool) {
+	PROFILE_SCOPE("intersect sweep");
+	PROFILE_COUNT("rays", cache.Size() * distances.size());
+	const size_t blockSize = 1024;	//small enough that a block of the cache stays in L1 while every distance gets written out
+	size_t numPoints = cache.Size();
+	auto sweep = [&](size_t begin, size_t end) {
+		for (size_t block = begin; block < end; block += blockSize) {
+			size_t blockEnd = std::min(block + blockSize, end);
+			for (size_t k = 0; k < distances.size(); k++) { IntersectRays<T>(cache, block, ix.subspan(k * numPoints + block, blockEnd - block), iy.subspan(k * numPoints + block, blockEnd - block), distances[k]); }
+		}
+	};
+	if (pool != nullptr) { pool->ParallelFor(numPoints, sweep); }
+	else { sweep(0, numPoints); }
+}
+
+template void PrepareIntersections<float>(const RayBuffer<float>&, IntersectionCache<float>*, ThreadPool*);
+template void PrepareIntersections<double>(const RayBuffer<double>&, IntersectionCache<double>*, ThreadPool*);
+template void PrepareIntersections<float>(const RayBuffer<float>&, std::span<const Light>, float, IntersectionCache<float>*, ThreadPool*);
+template void PrepareIntersections<double>(const RayBuffer<double>&, std::span<const Light>, double, IntersectionCache<double>*, ThreadPool*);
+template size_t SpectralLanes<float>();
+template size_t SpectralLanes<double>();
+template void PrepareSpectrum<float>(const RayBuffer<float>&, std::span<const float>, IntersectionCache<float>*, ThreadPool*);
+template void PrepareSpectrum<double>(const RayBuffer<double>&, std::span<const double>, IntersectionCache<double>*, ThreadPool*);
+template void IntersectRays<float>(const IntersectionCache<float>&, size_t, std::span<float>, std::span<float>, float);
+template void IntersectRays<double>(const IntersectionCache<double>&, size_t, std::span<double>, std::span<double>, double);
+template void IntersectRays<float>(const IntersectionCache<float>&, std::span<float>, std::span<float>, float, ThreadPool*);
+template void IntersectRays<double>(const IntersectionCache<double>&, std::span<double>, std::span<double>, double, ThreadPool*);
+template void IntersectPreview<float>(const IntersectionCache<float>&, size_t, std::span<float>, std::span<float>, float, ThreadPool*);
+template void IntersectPreview<double>(const IntersectionCache<double>&, size_t, std::span<double>, std::span<double>, double, ThreadPool*);
+template void IntersectSweep<float>(const IntersectionCache<float>&, std::span<const float>, std::span<float>, std::span<float>, ThreadPool*);
+template void IntersectSweep<double>(const IntersectionCache<double>&, std::span<const double>, std::span<double>, std::span<double>, ThreadPool*);
+
+void CalculateIntersections(const std::vector<Eigen::Vector3d>& vertices, const std::vector<Eigen::Vector3d>& refracteds, std::vector<Eigen::Vector2d>* intersections, double receiver_plane) {
+	intersections->resize(vertices.size());
+	CalculateIntersections(std::span<const Eigen::Vector3d>(vertices), std::span<const Eigen::Vector3d>(refracteds), std::span<Eigen::Vector2d>(*intersections), receiver_plane);
+}
+
+void CalculateIntersections(std::span<const Eigen::Vector3d> vertices, std::span<const Eigen::Vector3d> refracteds, std::span<Eigen::Vector2d> intersections, double receiver_plane) {	//returns the points on the receiver plane where the light rays from each vertex intersect
 
-	intersections->clear();	//clear the intersections every time we call the function 
 	int numPoints = int(vertices.size());
 
 	for (int i = 0; i < numPoints; i++) {
 		double t = (receiver_plane - vertices[i].z()) / refracteds[i].z();	//solve for t in vertex.z + ray.z*t = receiever_plane.z
 		Eigen::Vector2d intersection(vertices[i].x() + refracteds[i].x() * t, vertices[i].y() + refracteds[i].y() * t);
-		intersection = intersection * 128 + Eigen::Vector2d(128, 128); //vertices x,y range between (-1,1), transform to go from (0,256) to match the 256x256 target image
-		intersections->push_back(intersection);
+		intersections[i] = intersection * targetScale + Eigen::Vector2d(targetScale, targetScale); //vertices x,y range between (-1,1), transform to go from (0,256) to match the 256x256 target image
 	}													
 }
@@ -1,12 +1,77 @@
 #pragma once
 #include <iostream>
 #include <fstream>
+#include <span>
 #include <string>
 #include <vector>
 #include "Eigen/Core"
+#include "bvh.h"
+#include "heightfield.h"
+#include "light.h"
+#include "mappedfile.h"
+#include "raybuffer.h"
 
-void ParseOBJ(std::string objFilePath, std::vector<Eigen::Vector3d>* vertices, std::vector<Eigen::Vector3d>* normals);
+constexpr double glassEta = 1.457;	//refractive index of the glass the lenses are made of, what the shipped lens was generated with
+const double targetScale = 128;	//vertices x,y range between (-1,1), intersections get scaled by this and then offset by it to land in (0,256) to match the 256x256 target image
 
-void Refract(std::vector<Eigen::Vector3d> normals, std::vector<Eigen::Vector3d>* refracteds, double n);
+//with normalIndex, also reads the f records for which normal each vertex uses, left empty when they pair up one to one anyway
+//with triangles, also fans every face out into triangles, three vertex indices each
+//with a pool, every thread parses its own run of lines straight into place, same output in the same order
+void ParseOBJ(std::string objFilePath, std::vector<Eigen::Vector3d>* vertices, std::vector<Eigen::Vector3d>* normals, std::vector<uint32_t>* normalIndex = nullptr, std::vector<uint32_t>* triangles = nullptr, ThreadPool* pool = nullptr);
 
-void CalculateIntersections(std::vector<Eigen::Vector3d> vertices, std::vector<Eigen::Vector3d> refracteds, std::vector<Eigen::Vector2d>* intersections, double d);
+class OBJReader {	//reads an obj a chunk at a time for meshes that don't fit in memory, one cursor walks the v lines and another the vn lines
+public:
+	explicit OBJReader(const std::string& objFilePath);
+	bool IsOpen() const { return file.IsOpen(); }
+	size_t Read(size_t maxVertices, std::vector<Eigen::Vector3d>* vertices, std::vector<Eigen::Vector3d>* normals);	//replaces the contents with the next matching vertex/normal pairs, returns how many, 0 once either block runs out
+
+private:
+	const char* Next(const char* cursor, char kind, Eigen::Vector3d* value) const;	//parses the next "v" or "vn" line at or after cursor, returns the line after it or nullptr at the end
+
+	MappedFile file;
+	const char* vertexCursor = nullptr;
+	const char* normalCursor = nullptr;
+	const char* end = nullptr;
+};
+
+void Refract(const std::vector<Eigen::Vector3d>& normals, std::vector<Eigen::Vector3d>* refracteds, double n);
+void Refract(std::span<const Eigen::Vector3d> normals, std::span<Eigen::Vector3d> refracteds, double n);	//refracteds must already be the same size as normals
+
+void CalculateIntersections(const std::vector<Eigen::Vector3d>& vertices, const std::vector<Eigen::Vector3d>& refracteds, std::vector<Eigen::Vector2d>* intersections, double d);
+void CalculateIntersections(std::span<const Eigen::Vector3d> vertices, std::span<const Eigen::Vector3d> refracteds, std::span<Eigen::Vector2d> intersections, double d);	//intersections must already be the same size as vertices, so it can be reused between calls
+
+template <typename T>
+void RefractRays(std::span<const T> nx, std::span<const T> ny, std::span<const T> nz, std::span<T> rx, std::span<T> ry, std::span<T> rz, std::span<T> irz, T eta);	//SIMD version of Refract over structure of arrays data, instantiated for float and double
+template <typename T>
+void RefractRays(std::span<const T> nx, std::span<const T> ny, std::span<const T> nz, std::span<const uint32_t> normalIndex, std::span<T> rx, std::span<T> ry, std::span<T> rz, std::span<T> irz, T eta);	//ray i uses normal normalIndex[i], for meshes whose vertices share normals
+template <typename T>
+void RefractRays(RayBuffer<T>* rays, T eta, ThreadPool* pool = nullptr);	//with a pool, each thread refracts its own chunk of the rays
+
+template <typename T>
+void IntersectRays(std::span<const T> vx, std::span<const T> vy, std::span<const T> vz, std::span<const T> rx, std::span<const T> ry, std::span<const T> irz, std::span<T> ix, std::span<T> iy, T receiver_plane);	//SIMD version of CalculateIntersections, ix and iy get the already scaled target image coordinates
+template <typename T>
+void IntersectRays(const RayBuffer<T>& rays, std::span<T> ix, std::span<T> iy, T receiver_plane, ThreadPool* pool = nullptr);
+
+template <typename T>
+void TriangleFlux(const RayBuffer<T>& rays, std::span<T> flux, ThreadPool* pool = nullptr);	//light arrives along z, so what a triangle carries is its area projected onto x-y, in target image units squared, flux needs one entry per triangle
+
+template <typename T>
+void PrepareIntersections(const RayBuffer<T>& rays, IntersectionCache<T>* cache, ThreadPool* pool = nullptr);	//fills in the per-ray base points and slopes, needs the refracted directions
+template <typename T>
+void PrepareIntersections(const RayBuffer<T>& rays, std::span<const Light> lights, T eta, IntersectionCache<T>* cache, ThreadPool* pool = nullptr);	//refracts and prepares every light in one pass over the mesh, without storing the directions, rays of lights[k] are [k * rays.Size(), (k + 1) * rays.Size()) of the cache
+//two refractions, light enters the glass at the rays' surface and leaves through exitSurface, found through exitBVH built over it, then goes on to the wall
+//same layout as the one surface version, rays that miss the exit or get totally internally reflected at either surface are sent off to the side
+void PrepareIntersections(const RayBuffer<double>& rays, std::span<const Light> lights, double eta, const RayBuffer<double>& exitSurface, const TriangleBVH& exitBVH, IntersectionCache<double>* cache, ThreadPool* pool = nullptr);
+void PrepareIntersections(const Heightfield& field, double eta, IntersectionCache<double>* cache, ThreadPool* pool = nullptr);	//beam along +z through a heightfield, the normals come from finite differences of the heights in registers and never get stored, ray i is height sample i
+template <typename T>
+size_t SpectralLanes();	//PrepareSpectrum wants a multiple of this many etas, one SIMD register of T
+template <typename T>
+void PrepareSpectrum(const RayBuffer<T>& rays, std::span<const T> etas, IntersectionCache<T>* cache, ThreadPool* pool = nullptr);	//beam along +z at every eta at once, the lanes are wavelengths sharing one normal, ray i at etas[k] is i * etas.size() + k of the cache
+template <typename T>
+void IntersectRays(const IntersectionCache<T>& cache, std::span<T> ix, std::span<T> iy, T receiver_plane, ThreadPool* pool = nullptr);	//same output as the RayBuffer version, but only two FMAs per ray
+template <typename T>
+void IntersectRays(const IntersectionCache<T>& cache, size_t begin, std::span<T> ix, std::span<T> iy, T receiver_plane);	//just rays [begin, begin + ix.size()), for callers that stream the frame through a small buffer
+template <typename T>
+void IntersectPreview(const IntersectionCache<T>& cache, size_t stride, std::span<T> ix, std::span<T> iy, T receiver_plane, ThreadPool* pool = nullptr);	//every stride-th ray only, ray j * stride goes to ix[j], for a quick low density frame while the full one is still coming
+template <typename T>
+void IntersectSweep(const IntersectionCache<T>& cache, std::span<const T> distances, std::span<T> ix, std::span<T> iy, ThreadPool* pool = nullptr);	//one frame per distance in a single pass over the cache, frame k lives at [k * cache.Size(), (k + 1) * cache.Size())
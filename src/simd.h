@@ -0,0 +1,164 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+//thin wrappers over the vector instructions the ray kernels need, Simd<T> is the widest version the translation unit is compiled for
+//(-mavx512f, -mavx2 -mfma or /arch:AVX2, aarch64 NEON) and falls back to SimdScalar<T>, which is also what the kernels use for the leftover tail
+
+template <typename T>
+struct SimdScalar {
+	using Reg = T;
+	using Mask = bool;
+	static constexpr int width = 1;
+
+	static Reg Load(const T* p) { return *p; }
+	static Reg Gather(const T* base, const uint32_t* index) { return base[*index]; }	//base[index[lane]] for every lane
+	static void Store(T* p, Reg a) { *p = a; }
+	static Reg Set1(T a) { return a; }
+	static Reg Add(Reg a, Reg b) { return a + b; }
+	static Reg Sub(Reg a, Reg b) { return a - b; }
+	static Reg Mul(Reg a, Reg b) { return a * b; }
+	static Reg Div(Reg a, Reg b) { return a / b; }
+	static Reg MulAdd(Reg a, Reg b, Reg c) { return a * b + c; }
+	static Reg Max(Reg a, Reg b) { return a > b ? a : b; }
+	static Reg Sqrt(Reg a) { return std::sqrt(a); }
+	static Mask LessEqual(Reg a, Reg b) { return a <= b; }
+	static Reg Select(Mask m, Reg a, Reg b) { return m ? a : b; }	//a where the mask is set, b everywhere else
+};
+
+template <typename T>
+struct Simd : SimdScalar<T> {};
+
+#if defined(__AVX512F__)
+template <>
+struct Simd<double> {
+	using Reg = __m512d;
+	using Mask = __mmask8;
+	static constexpr int width = 8;
+
+	static Reg Load(const double* p) { return _mm512_loadu_pd(p); }
+	static Reg Gather(const double* base, const uint32_t* index) { return _mm512_i32gather_pd(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(index)), base, 8); }
+	static void Store(double* p, Reg a) { _mm512_storeu_pd(p, a); }
+	static Reg Set1(double a) { return _mm512_set1_pd(a); }
+	static Reg Add(Reg a, Reg b) { return _mm512_add_pd(a, b); }
+	static Reg Sub(Reg a, Reg b) { return _mm512_sub_pd(a, b); }
+	static Reg Mul(Reg a, Reg b) { return _mm512_mul_pd(a, b); }
+	static Reg Div(Reg a, Reg b) { return _mm512_div_pd(a, b); }
+	static Reg MulAdd(Reg a, Reg b, Reg c) { return _mm512_fmadd_pd(a, b, c); }
+	static Reg Max(Reg a, Reg b) { return _mm512_max_pd(a, b); }
+	static Reg Sqrt(Reg a) { return _mm512_sqrt_pd(a); }
+	static Mask LessEqual(Reg a, Reg b) { return _mm512_cmp_pd_mask(a, b, _CMP_LE_OQ); }
+	static Reg Select(Mask m, Reg a, Reg b) { return _mm512_mask_blend_pd(m, b, a); }
+};
+
+template <>
+struct Simd<float> {
+	using Reg = __m512;
+	using Mask = __mmask16;
+	static constexpr int width = 16;
+
+	static Reg Load(const float* p) { return _mm512_loadu_ps(p); }
+	static Reg Gather(const float* base, const uint32_t* index) { return _mm512_i32gather_ps(_mm512_loadu_si512(index), base, 4); }
+	static void Store(float* p, Reg a) { _mm512_storeu_ps(p, a); }
+	static Reg Set1(float a) { return _mm512_set1_ps(a); }
+	static Reg Add(Reg a, Reg b) { return _mm512_add_ps(a, b); }
+	static Reg Sub(Reg a, Reg b) { return _mm512_sub_ps(a, b); }
+	static Reg Mul(Reg a, Reg b) { return _mm512_mul_ps(a, b); }
+	static Reg Div(Reg a, Reg b) { return _mm512_div_ps(a, b); }
+	static Reg MulAdd(Reg a, Reg b, Reg c) { return _mm512_fmadd_ps(a, b, c); }
+	static Reg Max(Reg a, Reg b) { return _mm512_max_ps(a, b); }
+	static Reg Sqrt(Reg a) { return _mm512_sqrt_ps(a); }
+	static Mask LessEqual(Reg a, Reg b) { return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+	static Reg Select(Mask m, Reg a, Reg b) { return _mm512_mask_blend_ps(m, b, a); }
+};
+#elif defined(__AVX2__) && defined(__FMA__)
+template <>
+struct Simd<double> {
+	using Reg = __m256d;
+	using Mask = __m256d;
+	static constexpr int width = 4;
+
+	static Reg Load(const double* p) { return _mm256_loadu_pd(p); }
+	static Reg Gather(const double* base, const uint32_t* index) { return _mm256_i32gather_pd(base, _mm_loadu_si128(reinterpret_cast<const __m128i*>(index)), 8); }
+	static void Store(double* p, Reg a) { _mm256_storeu_pd(p, a); }
+	static Reg Set1(double a) { return _mm256_set1_pd(a); }
+	static Reg Add(Reg a, Reg b) { return _mm256_add_pd(a, b); }
+	static Reg Sub(Reg a, Reg b) { return _mm256_sub_pd(a, b); }
+	static Reg Mul(Reg a, Reg b) { return _mm256_mul_pd(a, b); }
+	static Reg Div(Reg a, Reg b) { return _mm256_div_pd(a, b); }
+	static Reg MulAdd(Reg a, Reg b, Reg c) { return _mm256_fmadd_pd(a, b, c); }
+	static Reg Max(Reg a, Reg b) { return _mm256_max_pd(a, b); }
+	static Reg Sqrt(Reg a) { return _mm256_sqrt_pd(a); }
+	static Mask LessEqual(Reg a, Reg b) { return _mm256_cmp_pd(a, b, _CMP_LE_OQ); }
+	static Reg Select(Mask m, Reg a, Reg b) { return _mm256_blendv_pd(b, a, m); }
+};
+
+template <>
+struct Simd<float> {
+	using Reg = __m256;
+	using Mask = __m256;
+	static constexpr int width = 8;
+
+	static Reg Load(const float* p) { return _mm256_loadu_ps(p); }
+	static Reg Gather(const float* base, const uint32_t* index) { return _mm256_i32gather_ps(base, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(index)), 4); }
+	static void Store(float* p, Reg a) { _mm256_storeu_ps(p, a); }
+	static Reg Set1(float a) { return _mm256_set1_ps(a); }
+	static Reg Add(Reg a, Reg b) { return _mm256_add_ps(a, b); }
+	static Reg Sub(Reg a, Reg b) { return _mm256_sub_ps(a, b); }
+	static Reg Mul(Reg a, Reg b) { return _mm256_mul_ps(a, b); }
+	static Reg Div(Reg a, Reg b) { return _mm256_div_ps(a, b); }
+	static Reg MulAdd(Reg a, Reg b, Reg c) { return _mm256_fmadd_ps(a, b, c); }
+	static Reg Max(Reg a, Reg b) { return _mm256_max_ps(a, b); }
+	static Reg Sqrt(Reg a) { return _mm256_sqrt_ps(a); }
+	static Mask LessEqual(Reg a, Reg b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+	static Reg Select(Mask m, Reg a, Reg b) { return _mm256_blendv_ps(b, a, m); }
+};
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+template <>
+struct Simd<double> {
+	using Reg = float64x2_t;
+	using Mask = uint64x2_t;
+	static constexpr int width = 2;
+
+	static Reg Load(const double* p) { return vld1q_f64(p); }
+	static Reg Gather(const double* base, const uint32_t* index) { double lanes[2] = { base[index[0]], base[index[1]] }; return vld1q_f64(lanes); }	//no gather instruction on NEON
+	static void Store(double* p, Reg a) { vst1q_f64(p, a); }
+	static Reg Set1(double a) { return vdupq_n_f64(a); }
+	static Reg Add(Reg a, Reg b) { return vaddq_f64(a, b); }
+	static Reg Sub(Reg a, Reg b) { return vsubq_f64(a, b); }
+	static Reg Mul(Reg a, Reg b) { return vmulq_f64(a, b); }
+	static Reg Div(Reg a, Reg b) { return vdivq_f64(a, b); }
+	static Reg MulAdd(Reg a, Reg b, Reg c) { return vfmaq_f64(c, a, b); }
+	static Reg Max(Reg a, Reg b) { return vmaxq_f64(a, b); }
+	static Reg Sqrt(Reg a) { return vsqrtq_f64(a); }
+	static Mask LessEqual(Reg a, Reg b) { return vcleq_f64(a, b); }
+	static Reg Select(Mask m, Reg a, Reg b) { return vbslq_f64(m, a, b); }
+};
+
+template <>
+struct Simd<float> {
+	using Reg = float32x4_t;
+	using Mask = uint32x4_t;
+	static constexpr int width = 4;
+
+	static Reg Load(const float* p) { return vld1q_f32(p); }
+	static Reg Gather(const float* base, const uint32_t* index) { float lanes[4] = { base[index[0]], base[index[1]], base[index[2]], base[index[3]] }; return vld1q_f32(lanes); }
+	static void Store(float* p, Reg a) { vst1q_f32(p, a); }
+	static Reg Set1(float a) { return vdupq_n_f32(a); }
+	static Reg Add(Reg a, Reg b) { return vaddq_f32(a, b); }
+	static Reg Sub(Reg a, Reg b) { return vsubq_f32(a, b); }
+	static Reg Mul(Reg a, Reg b) { return vmulq_f32(a, b); }
+	static Reg Div(Reg a, Reg b) { return vdivq_f32(a, b); }
+	static Reg MulAdd(Reg a, Reg b, Reg c) { return vfmaq_f32(c, a, b); }
+	static Reg Max(Reg a, Reg b) { return vmaxq_f32(a, b); }
+	static Reg Sqrt(Reg a) { return vsqrtq_f32(a); }
+	static Mask LessEqual(Reg a, Reg b) { return vcleq_f32(a, b); }
+	static Reg Select(Mask m, Reg a, Reg b) { return vbslq_f32(m, a, b); }
+};
+#endif
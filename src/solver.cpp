@@ -0,0 +1,56 @@
+#include "solver.h"
+
+#include <utility>
+
+SolverThread::SolverThread(std::function<void(const FrameRequest&, SolverThread*)> render, std::function<void()> ready) : render(std::move(render)), ready(std::move(ready)), thread([this] { Loop(); }) {}
+
+SolverThread::~SolverThread() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+		requested++;
+	}
+	wake.notify_one();
+	thread.join();	//the render in flight sees Superseded and gives up early, if it checks
+}
+
+void SolverThread::Request(const FrameRequest& request) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		pending = request;
+		hasPending = true;
+		requested++;
+	}
+	wake.notify_one();
+}
+
+Frame* SolverThread::Latest() {
+	return frames.Update() ? &frames.Front() : nullptr;
+}
+
+Frame* SolverThread::Back() {
+	Frame* frame = &frames.Back();
+	frame->request = currentRequest;
+	return frame;
+}
+
+void SolverThread::Publish() {
+	frames.Publish();
+	ready();
+}
+
+void SolverThread::Loop() {
+	while (true) {
+		FrameRequest request;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [this] { return hasPending || stop; });
+			if (stop) { return; }
+			request = pending;
+			hasPending = false;
+			current = requested.load(std::memory_order_relaxed);
+		}
+		currentRequest = request;
+		render(request, this);
+	}
+}
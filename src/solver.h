@@ -0,0 +1,54 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "triplebuffer.h"
+
+struct FrameRequest {
+	double receiverPlane = 0;
+	int width = 0;	//window size the frame is for
+	int height = 0;
+};
+
+struct Frame {	//one finished image, tone mapped and ready to upload
+	FrameRequest request;
+	std::vector<uint32_t> argb;	//width * height ARGB8888 pixels, rows packed
+};
+
+class SolverThread {	//solves and tone maps frames off the UI thread, so the event loop never blocks on a solve
+public:
+	//render solves the request on the solver thread, filling Back and calling Publish for every frame it wants shown, coarse previews first if it likes
+	//it should check Superseded between steps and return early once it's true, ready is called after every Publish to wake the UI thread up
+	SolverThread(std::function<void(const FrameRequest&, SolverThread*)> render, std::function<void()> ready);
+	~SolverThread();
+	SolverThread(const SolverThread&) = delete;
+	SolverThread& operator=(const SolverThread&) = delete;
+
+	void Request(const FrameRequest& request);	//replaces any request the thread hasn't started on yet, so a burst of key repeats only solves the last distance
+	Frame* Latest();	//UI thread, the newest finished frame if there's one that wasn't returned before, nullptr otherwise, valid until the next call
+
+	Frame* Back();		//solver thread, the frame to fill before the next Publish, its request is already set
+	void Publish();
+	bool Superseded() const { return requested.load(std::memory_order_acquire) != current; }	//solver thread, whether a newer request came in since the one being rendered was taken, finishing this one would be wasted work
+
+private:
+	void Loop();
+
+	std::function<void(const FrameRequest&, SolverThread*)> render;
+	std::function<void()> ready;
+	TripleBuffer<Frame> frames;
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	FrameRequest pending;
+	bool hasPending = false;
+	std::atomic<uint64_t> requested{ 0 };	//bumped by every Request
+	uint64_t current = 0;					//the value of requested when the request being rendered was taken
+	FrameRequest currentRequest;
+	bool stop = false;
+	std::thread thread;	//last, so everything it uses exists before it starts
+};
@@ -0,0 +1,75 @@
+#include "spatialsort.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "profile.h"
+
+static uint32_t SpreadBits(uint32_t x) {	//puts the low 16 bits of x into the even bits
+	x &= 0xFFFF;
+	x = (x | (x << 8)) & 0x00FF00FF;
+	x = (x | (x << 4)) & 0x0F0F0F0F;
+	x = (x | (x << 2)) & 0x33333333;
+	x = (x | (x << 1)) & 0x55555555;
+	return x;
+}
+
+void SortRaysSpatially(RayBuffer<double>* rays, ThreadPool* pool) {
+	PROFILE_SCOPE("spatial sort");
+	size_t n = rays->Size();
+	if (n < 2) { return; }
+
+	double minX = rays->vx[0], maxX = minX, minY = rays->vy[0], maxY = minY;
+	for (size_t i = 1; i < n; i++) {
+		minX = std::min(minX, rays->vx[i]); maxX = std::max(maxX, rays->vx[i]);
+		minY = std::min(minY, rays->vy[i]); maxY = std::max(maxY, rays->vy[i]);
+	}
+	double scaleX = maxX > minX ? 65535 / (maxX - minX) : 0;	//16 bits a side, finer than any window the rays get binned into
+	double scaleY = maxY > minY ? 65535 / (maxY - minY) : 0;
+
+	std::vector<uint64_t> keys(n);	//Morton code above the original index, so one sort of plain integers gives the permutation and ties keep their obj order
+	auto encode = [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			uint32_t qx = uint32_t((rays->vx[i] - minX) * scaleX), qy = uint32_t((rays->vy[i] - minY) * scaleY);
+			keys[i] = (uint64_t(SpreadBits(qx) | (SpreadBits(qy) << 1)) << 32) | i;
+		}
+	};
+	if (pool != nullptr) { pool->ParallelFor(n, encode); }
+	else { encode(0, n); }
+	std::sort(keys.begin(), keys.end());
+
+	bool sharedNormals = !rays->normalIndex.empty();
+	RayBuffer<double> sorted;
+	sorted.Resize(n, sharedNormals ? rays->NumNormals() : n);	//shared normals stay where they are, only the index moves
+	double* components[6];
+	for (int k = 0; k < 6; k++) { components[k] = sorted.MeshComponent(k); }
+	const std::span<const double> sources[6] = { rays->vx, rays->vy, rays->vz, rays->nx, rays->ny, rays->nz };
+	if (sharedNormals) {
+		sorted.normalIndexStorage.resize(n);
+		for (int k = 3; k < 6; k++) { std::copy(sources[k].begin(), sources[k].end(), components[k]); }
+	}
+	std::vector<uint32_t> newIndex(rays->triangles.empty() ? 0 : n);	//where each original vertex ended up, for the triangle corners
+	auto gather = [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			uint32_t from = uint32_t(keys[i]);
+			for (int k = 0; k < 3; k++) { components[k][i] = sources[k][from]; }
+			if (sharedNormals) { sorted.normalIndexStorage[i] = rays->normalIndex[from]; }
+			else { for (int k = 3; k < 6; k++) { components[k][i] = sources[k][from]; } }
+			if (!newIndex.empty()) { newIndex[from] = uint32_t(i); }
+		}
+	};
+	if (pool != nullptr) { pool->ParallelFor(n, gather); }
+	else { gather(0, n); }
+	if (sharedNormals) { sorted.normalIndex = sorted.normalIndexStorage; }
+
+	if (!newIndex.empty()) {
+		sorted.triangleStorage.resize(rays->triangles.size());
+		auto remap = [&](size_t begin, size_t end) {
+			for (size_t c = begin; c < end; c++) { sorted.triangleStorage[c] = newIndex[rays->triangles[c]]; }
+		};
+		if (pool != nullptr) { pool->ParallelFor(rays->triangles.size(), remap); }
+		else { remap(0, rays->triangles.size()); }
+		sorted.triangles = sorted.triangleStorage;
+	}
+	*rays = std::move(sorted);
+}
@@ -0,0 +1,8 @@
+#pragma once
+#include "raybuffer.h"
+#include "threadpool.h"
+
+//reorders the rays along a Morton curve over their x,y, so rays next to each other in memory also land next to each other on the wall and the binning writes stay in a few cache lines at a time
+//vertices, normals (or the normal index when they're shared), and the triangle corners all move together, afterwards the buffer owns its mesh even if it was viewing a cache before
+//ray order is visible in --raw dumps, those come out in the sorted order too
+void SortRaysSpatially(RayBuffer<double>* rays, ThreadPool* pool = nullptr);
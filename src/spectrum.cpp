@@ -0,0 +1,50 @@
+#include "spectrum.h"
+
+#include <algorithm>
+#include <cmath>
+
+double Dispersion::Index(double wavelength) const {
+	double l = wavelength / 1000, l2 = l * l;	//nanometres to micrometres
+	if (model == cauchy) { return b[0] + b[1] / l2 + b[2] / (l2 * l2); }
+	double n2 = 1;
+	for (int k = 0; k < 3; k++) { n2 += b[k] * l2 / (l2 - c[k]); }
+	return std::sqrt(n2);
+}
+
+static double Lobe(double wavelength, double mean, double belowWidth, double aboveWidth) {	//gaussian with a different width on either side of its peak
+	double t = (wavelength - mean) / (wavelength < mean ? belowWidth : aboveWidth);
+	return std::exp(-0.5 * t * t);
+}
+
+static void WavelengthToRGB(double wavelength, float* rgb) {	//CIE 1931 observer from the multi-lobe fit of Wyman, Sloan and Shirley, then XYZ to linear sRGB with the out of gamut part clipped
+	double x = 1.056 * Lobe(wavelength, 599.8, 37.9, 31.0) + 0.362 * Lobe(wavelength, 442.0, 16.0, 26.7) - 0.065 * Lobe(wavelength, 501.1, 20.4, 26.2);
+	double y = 0.821 * Lobe(wavelength, 568.8, 46.9, 40.5) + 0.286 * Lobe(wavelength, 530.9, 16.3, 31.1);
+	double z = 1.217 * Lobe(wavelength, 437.0, 11.8, 36.0) + 0.681 * Lobe(wavelength, 459.0, 26.0, 13.8);
+	rgb[0] = float(std::max(0.0, 3.2406 * x - 1.5372 * y - 0.4986 * z));
+	rgb[1] = float(std::max(0.0, -0.9689 * x + 1.8758 * y + 0.0415 * z));
+	rgb[2] = float(std::max(0.0, 0.0557 * x - 0.2040 * y + 1.0570 * z));
+}
+
+Spectrum MakeSpectrum(const Dispersion& dispersion, int numWavelengths, double referenceEta, size_t lanes) {
+	Spectrum spectrum;
+	numWavelengths = std::max(numWavelengths, 1);
+	lanes = std::max<size_t>(lanes, 1);
+	size_t padded = (size_t(numWavelengths) + lanes - 1) / lanes * lanes;
+	double shift = referenceEta - dispersion.Index(589.3);
+	spectrum.colors.assign(padded * 3, 0.0f);
+
+	float sums[3] = { 0, 0, 0 };
+	for (int k = 0; k < numWavelengths; k++) {
+		double wavelength = 400 + 300 * (k + 0.5) / numWavelengths;	//middle of each band
+		spectrum.wavelengths.push_back(wavelength);
+		spectrum.etas.push_back(dispersion.Index(wavelength) + shift);
+		WavelengthToRGB(wavelength, &spectrum.colors[size_t(k) * 3]);
+		for (int c = 0; c < 3; c++) { sums[c] += spectrum.colors[size_t(k) * 3 + c]; }
+	}
+	for (size_t i = 0; i < size_t(numWavelengths) * 3; i++) {
+		if (sums[i % 3] > 0) { spectrum.colors[i] /= sums[i % 3]; }
+	}
+	spectrum.wavelengths.resize(padded, spectrum.wavelengths.back());
+	spectrum.etas.resize(padded, spectrum.etas.back());
+	return spectrum;
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+struct Dispersion {	//how the refractive index of the lens material changes with wavelength, wavelengths in micrometres like the published coefficients
+	enum Model { cauchy, sellmeier };
+	Model model = sellmeier;
+	double b[3] = { 0.6961663, 0.4079426, 0.8974794 };				//sellmeier B terms, or cauchy A, B (um^2) and C (um^4), fused silica (Malitson 1965) by default
+	double c[3] = { 0.00467914826, 0.0135120631, 97.9340025 };		//sellmeier C terms in um^2, unused by cauchy
+
+	double Index(double wavelength) const;	//refractive index at wavelength in nanometres
+
+	static Dispersion FusedSilica() { return Dispersion(); }
+	static Dispersion BK7() { return { sellmeier, { 1.03961212, 0.231792344, 1.01046945 }, { 0.00600069867, 0.0200179144, 103.560653 } }; }
+	static Dispersion Cauchy(double a, double b) { return { cauchy, { a, b, 0 }, { 0, 0, 0 } }; }
+};
+
+struct Spectrum {	//the wavelengths a spectral solve traces, each one a full set of rays through the same mesh
+	std::vector<double> wavelengths;	//in nanometres
+	std::vector<double> etas;			//refractive index at each wavelength
+	std::vector<float> colors;			//linear RGB weight of each wavelength, 3 each, every channel sums to 1 over the spectrum so a white caustic has the same counts as a gray one
+};
+
+//numWavelengths bands evenly across 400-700nm, the indices get shifted so the sodium D line at 589.3nm sees exactly referenceEta, which is what the lens was designed with
+//padded with copies of the last wavelength up to a multiple of lanes, those carry no colour, so the kernel can put one wavelength per SIMD lane without a tail
+Spectrum MakeSpectrum(const Dispersion& dispersion, int numWavelengths, double referenceEta, size_t lanes);
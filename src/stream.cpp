@@ -0,0 +1,99 @@
+#include "stream.h"
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "meshcache.h"
+#include "profile.h"
+#include "queue.h"
+#include "refract.h"
+
+namespace {
+
+struct StreamChunk {	//everything one chunk needs on its way through the pipeline, a few of them get recycled so nothing is allocated per chunk
+	RayBuffer<double> rays;
+	std::vector<Eigen::Vector3d> vertices, normals;
+	IntersectionCache<double> cache;	//the chunk's rays for every light
+	RayArray<double> intersectionsX, intersectionsY;	//one slice of lights * chunkSize per distance
+	size_t size = 0;	//0 marks the end of the mesh
+};
+
+const size_t numStreamChunks = 4;	//one in every stage plus one queued, enough to keep all three busy
+
+}
+
+size_t StreamCaustics(const std::string& objPath, bool useMeshCache, bool faces, std::span<const Light> lights, std::span<const double> distances, double eta, size_t chunkSize, std::span<Histogram> images, ThreadPool* pool) {
+	MeshCache meshCache;
+	RayBuffer<double> whole;						//views of the entire mapped cache, chunks are views of slices of it
+	std::unique_ptr<OBJReader> obj;
+	if (useMeshCache && meshCache.Open(objPath, faces)) { meshCache.View(&whole); }
+	else {
+		if (faces) { std::cout << "Streaming straight from the obj pairs v and vn by position, load it once without --stream to build a cache that has the face pairing\n"; }
+		obj = std::make_unique<OBJReader>(objPath);
+		if (!obj->IsOpen()) { return 0; }
+	}
+
+	//three stages on their own threads, chunk N + 1 gets parsed while chunk N is solved and chunk N - 1 is binned, the pool only ever serves the solve stage
+	std::vector<StreamChunk> chunks(numStreamChunks);
+	SpscQueue<StreamChunk*, numStreamChunks> empty, parsed, solved;
+	for (StreamChunk& chunk : chunks) {
+		chunk.intersectionsX.resize(distances.size() * lights.size() * chunkSize);
+		chunk.intersectionsY.resize(distances.size() * lights.size() * chunkSize);
+		empty.Push(&chunk);
+	}
+	for (Histogram& image : images) { image.Clear(); }
+
+	std::thread reader([&] {
+		size_t position = 0;
+		while (true) {
+			StreamChunk* chunk = empty.Pop();
+			PROFILE_SCOPE("read chunk");
+			if (obj != nullptr) {
+				chunk->size = obj->Read(chunkSize, &chunk->vertices, &chunk->normals);
+				if (chunk->size > 0) { FillRayBuffer(chunk->vertices, chunk->normals, &chunk->rays); }
+			}
+			else {
+				chunk->size = std::min(chunkSize, whole.Size() - position);
+				size_t n = chunk->size;
+				if (n > 0 && whole.normalIndex.empty()) { chunk->rays.View(whole.vx.subspan(position, n), whole.vy.subspan(position, n), whole.vz.subspan(position, n), whole.nx.subspan(position, n), whole.ny.subspan(position, n), whole.nz.subspan(position, n)); }
+				else if (n > 0) { chunk->rays.View(whole.vx.subspan(position, n), whole.vy.subspan(position, n), whole.vz.subspan(position, n), whole.nx, whole.ny, whole.nz, whole.normalIndex.subspan(position, n)); }	//shared normals stay whole, only the index gets sliced
+				position += chunk->size;
+			}
+			parsed.Push(chunk);
+			if (chunk->size == 0) { return; }
+		}
+	});
+
+	size_t total = 0;
+	const size_t slice = lights.size() * chunkSize;
+	std::thread binner([&] {
+		while (true) {
+			StreamChunk* chunk = solved.Pop();
+			if (chunk->size == 0) { return; }
+			for (size_t k = 0; k < distances.size(); k++) {
+				size_t n = chunk->cache.Size();
+				images[k].Add<double>(std::span<const double>(chunk->intersectionsX).subspan(k * slice, n), std::span<const double>(chunk->intersectionsY).subspan(k * slice, n), images[k].Width() / 256.0, images[k].Height() / 256.0);
+			}
+			total += chunk->size;
+			empty.Push(chunk);
+		}
+	});
+
+	while (true) {
+		StreamChunk* chunk = parsed.Pop();
+		if (chunk->size > 0) {
+			PrepareIntersections<double>(chunk->rays, lights, eta, &chunk->cache, pool);
+			size_t n = chunk->cache.Size();
+			for (size_t k = 0; k < distances.size(); k++) {	//the chunk is refracted once and then dropped onto every wall position
+				IntersectRays<double>(chunk->cache, std::span<double>(chunk->intersectionsX).subspan(k * slice, n), std::span<double>(chunk->intersectionsY).subspan(k * slice, n), distances[k], pool);
+			}
+		}
+		solved.Push(chunk);
+		if (chunk->size == 0) { break; }
+	}
+	reader.join();
+	binner.join();
+	return total;
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include <cstddef>
+#include <span>
+#include <string>
+#include "histogram.h"
+#include "light.h"
+#include "threadpool.h"
+
+//out of core solve, reads the mesh chunkSize rays at a time and bins every chunk straight into the images, so memory stays at a few chunks no matter how big the lens is
+//reading, solving and binning run as a pipeline on separate threads, so a pass costs about as much as its slowest stage
+//images[k] gets the caustics at distances[k] and has to be sized already, chunks come from the mesh cache when there's a valid one and from the obj otherwise
+//every chunk is refracted for all lights in one go, their caustics add up in every image
+//faces picks the cache built from the f records, the obj itself can only be streamed with v and vn paired by position
+//returns how many rays went through, 0 if the mesh couldn't be read
+size_t StreamCaustics(const std::string& objPath, bool useMeshCache, bool faces, std::span<const Light> lights, std::span<const double> distances, double eta, size_t chunkSize, std::span<Histogram> images, ThreadPool* pool = nullptr);
@@ -0,0 +1,76 @@
+#include "supersample.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "profile.h"
+#include "refract.h"
+
+static uint32_t Hash(uint32_t x) {	//cheap integer mixer, good enough to decorrelate the jitter of neighbouring strata
+	x ^= x >> 16;
+	x *= 0x7FEB352Du;
+	x ^= x >> 15;
+	x *= 0x846CA68Bu;
+	x ^= x >> 16;
+	return x;
+}
+
+static double Jitter(uint32_t triangle, uint32_t sample, uint32_t axis) { return Hash(triangle * 0x9E3779B9u ^ Hash(sample * 2 + axis)) * (1.0 / 4294967296.0); }	//in [0, 1)
+
+void SupersampleCaustics(const RayBuffer<double>& rays, std::span<const double> flux, int samplesPerSide, double eta, double receiverPlane, Histogram* image, ThreadPool* pool) {
+	PROFILE_SCOPE("supersample");
+	PROFILE_COUNT("rays", flux.size() * size_t(samplesPerSide) * size_t(samplesPerSide));
+	const size_t samples = size_t(samplesPerSide) * size_t(samplesPerSide);
+	const size_t blockRays = 4096;	//a block of samples lives in these buffers, small enough to stay in cache between the kernels
+	const size_t trianglesPerBlock = std::max<size_t>(1, blockRays / samples);
+	const double scaleX = image->Width() / 256.0, scaleY = image->Height() / 256.0;
+	const double width = image->Width(), height = image->Height();
+	image->Clear();
+
+	image->Splat(flux.size(), [&](size_t begin, size_t end, float* pixels) {
+		size_t capacity = trianglesPerBlock * samples;
+		std::vector<double> vx(capacity), vy(capacity), vz(capacity), nx(capacity), ny(capacity), nz(capacity);
+		std::vector<double> rx(capacity), ry(capacity), rz(capacity), irz(capacity), ix(capacity), iy(capacity), weight(capacity);
+		auto normal = [&](uint32_t vertex, int k) {
+			uint32_t n = rays.normalIndex.empty() ? vertex : rays.normalIndex[vertex];
+			return k == 0 ? rays.nx[n] : k == 1 ? rays.ny[n] : rays.nz[n];
+		};
+
+		for (size_t first = begin; first < end; first += trianglesPerBlock) {
+			size_t last = std::min(end, first + trianglesPerBlock), n = 0;
+			for (size_t t = first; t < last; t++) {
+				const uint32_t* corner = &rays.triangles[3 * t];
+				double w = flux[t] / double(samples);
+				for (int sy = 0; sy < samplesPerSide; sy++) {
+					for (int sx = 0; sx < samplesPerSide; sx++, n++) {
+						uint32_t sample = uint32_t(sy * samplesPerSide + sx);
+						double r1 = (sx + Jitter(uint32_t(t), sample, 0)) / samplesPerSide;	//stratified in the unit square
+						double r2 = (sy + Jitter(uint32_t(t), sample, 1)) / samplesPerSide;
+						double s = std::sqrt(r1);	//area preserving map onto the triangle, so the strata stay equal area
+						double b0 = 1 - s, b1 = s * (1 - r2), b2 = s * r2;
+						vx[n] = b0 * rays.vx[corner[0]] + b1 * rays.vx[corner[1]] + b2 * rays.vx[corner[2]];
+						vy[n] = b0 * rays.vy[corner[0]] + b1 * rays.vy[corner[1]] + b2 * rays.vy[corner[2]];
+						vz[n] = b0 * rays.vz[corner[0]] + b1 * rays.vz[corner[1]] + b2 * rays.vz[corner[2]];
+						double mx = b0 * normal(corner[0], 0) + b1 * normal(corner[1], 0) + b2 * normal(corner[2], 0);
+						double my = b0 * normal(corner[0], 1) + b1 * normal(corner[1], 1) + b2 * normal(corner[2], 1);
+						double mz = b0 * normal(corner[0], 2) + b1 * normal(corner[1], 2) + b2 * normal(corner[2], 2);
+						double length = std::sqrt(mx * mx + my * my + mz * mz);	//interpolated normals come out a bit short
+						nx[n] = mx / length; ny[n] = my / length; nz[n] = mz / length;
+						weight[n] = w;
+					}
+				}
+			}
+
+			RefractRays<double>(std::span<const double>(nx).first(n), std::span<const double>(ny).first(n), std::span<const double>(nz).first(n),
+				std::span<double>(rx).first(n), std::span<double>(ry).first(n), std::span<double>(rz).first(n), std::span<double>(irz).first(n), eta);
+			IntersectRays<double>(std::span<const double>(vx).first(n), std::span<const double>(vy).first(n), std::span<const double>(vz).first(n),
+				std::span<const double>(rx).first(n), std::span<const double>(ry).first(n), std::span<const double>(irz).first(n), std::span<double>(ix).first(n), std::span<double>(iy).first(n), receiverPlane);
+			for (size_t i = 0; i < n; i++) {
+				double x = ix[i] * scaleX, y = iy[i] * scaleY;
+				if (!(x >= 0 && x < width && y >= 0 && y < height)) { continue; }	//same as binning vertices, NaNs drop out too
+				pixels[size_t(y) * size_t(width) + size_t(x)] += float(weight[i] * scaleX * scaleY);
+			}
+		}
+	}, pool);
+}
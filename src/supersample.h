@@ -0,0 +1,11 @@
+#pragma once
+#include <span>
+#include "histogram.h"
+#include "raybuffer.h"
+#include "threadpool.h"
+
+//renders the caustics at receiverPlane from samplesPerSide * samplesPerSide rays per mesh triangle instead of one per vertex, clearing image first
+//sample positions are stratified over the triangle with a jitter hashed from the triangle and sample index, so frames are stable and identical for any thread count
+//positions and normals get interpolated from the corners and the rays are refracted and binned a small block at a time, they never exist for the whole mesh
+//every ray carries flux / samples of its triangle, flux as TriangleFlux computes it, needs rays.triangles
+void SupersampleCaustics(const RayBuffer<double>& rays, std::span<const double> flux, int samplesPerSide, double eta, double receiverPlane, Histogram* image, ThreadPool* pool = nullptr);
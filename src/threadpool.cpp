@@ -0,0 +1,126 @@
+#include "threadpool.h"
+
+#include <algorithm>
+#include <iostream>
+#include "profile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+static std::vector<int> AllowedCPUs() {	//the cpus this process may run on, which under taskset, cgroups or a job object can be fewer than the machine has and needn't start at 0
+	std::vector<int> cpus;
+#ifdef _WIN32
+	DWORD_PTR processMask = 0, systemMask = 0;
+	if (GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask)) {
+		for (int cpu = 0; cpu < int(sizeof(DWORD_PTR) * 8); cpu++) {
+			if (processMask & (DWORD_PTR(1) << cpu)) { cpus.push_back(cpu); }
+		}
+	}
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+		cpus.reserve(size_t(CPU_COUNT(&set)));
+		for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+			if (CPU_ISSET(cpu, &set)) { cpus.push_back(cpu); }
+		}
+	}
+#endif
+	return cpus;
+}
+
+static void PinThread(std::thread* thread, int cpu) {	//keep each worker on one core so the chunks it touches stay in its caches and on its NUMA node
+#ifdef _WIN32
+	SetThreadAffinityMask(thread->native_handle(), DWORD_PTR(1) << cpu);
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (pthread_setaffinity_np(thread->native_handle(), sizeof(set), &set) != 0) { std::cout << "Could not pin a worker thread to cpu " << cpu << ", it will float\n"; }
+#else
+	(void)thread; (void)cpu;	//no portable way to pin elsewhere, the chunks still stay with the same worker
+#endif
+}
+
+int ThreadPool::AvailableThreads() {
+	std::vector<int> cpus = AllowedCPUs();
+	return cpus.empty() ? std::max(1, int(std::thread::hardware_concurrency())) : int(cpus.size());
+}
+
+ThreadPool::ThreadPool(int numThreads) {
+	std::vector<int> cpus = AllowedCPUs();	//read once, worker i goes on the i-th allowed cpu
+	this->numThreads = numThreads > 0 ? numThreads : (cpus.empty() ? AvailableThreads() : int(cpus.size()));
+
+	for (int i = 1; i < this->numThreads; i++) {	//the calling thread works too, so it only needs numThreads - 1 helpers
+		workers.emplace_back([this, i] { WorkerLoop(i); });
+		if (!cpus.empty()) { PinThread(&workers.back(), cpus[size_t(i) % cpus.size()]); }	//no mask to go by means no pinning rather than guessing at cpu numbers
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+	wake.notify_all();
+	for (std::thread& worker : workers) { worker.join(); }
+}
+
+void ThreadPool::RunChunk(int index) {
+	size_t chunk = (jobCount + size_t(numThreads) - 1) / size_t(numThreads);
+	chunk = (chunk + jobAlignment - 1) / jobAlignment * jobAlignment;
+	size_t begin = std::min(size_t(index) * chunk, jobCount);
+	size_t end = std::min(begin + chunk, jobCount);
+	if (begin < end) {
+		PROFILE_SCOPE("pool chunk");	//shows how evenly a parallel loop kept the threads busy
+		(*job)(index, begin, end);
+	}
+}
+
+void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t, size_t)>& body, size_t alignment) {
+	if (workers.empty()) { body(0, count); return; }
+	ParallelChunks(count, [&body](int, size_t begin, size_t end) { body(begin, end); }, alignment);
+}
+
+void ThreadPool::ParallelChunks(size_t count, const std::function<void(int, size_t, size_t)>& body, size_t alignment) {
+	if (workers.empty()) { body(0, 0, count); return; }
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		job = &body;
+		jobCount = count;
+		jobAlignment = alignment;
+		pending = int(workers.size());
+		generation++;
+	}
+	wake.notify_all();
+
+	RunChunk(0);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [this] { return pending == 0; });
+	job = nullptr;
+}
+
+void ThreadPool::WorkerLoop(int index) {
+	size_t seenGeneration = 0;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [this, seenGeneration] { return stop || generation != seenGeneration; });
+			if (stop) { return; }
+			seenGeneration = generation;
+		}
+
+		RunChunk(index);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--pending == 0) { done.notify_one(); }
+	}
+}
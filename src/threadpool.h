@@ -0,0 +1,42 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {	//persistent worker threads, created once at startup so the per-ray loops don't pay for spawning threads on every solve
+public:
+	explicit ThreadPool(int numThreads);	//0 means one thread per cpu the process is allowed on, 1 runs everything inline on the calling thread
+	~ThreadPool();
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	int NumThreads() const { return numThreads; }
+	static int AvailableThreads();	//cpus in the process affinity mask, or hardware_concurrency where there's no mask to read
+
+	//splits [0, count) into one contiguous chunk per thread and runs body(begin, end) on each, the calling thread takes the first chunk
+	//a given thread always gets the same chunk of a given count, so with the workers pinned, pages first touched through the pool stay local to the NUMA node that uses them
+	//chunk sizes are rounded up to a multiple of alignment, the default keeps boundaries on whole cache lines for per-ray arrays, pass 1 to split a handful of big work items
+	//not reentrant, body must not call back into the same pool
+	void ParallelFor(size_t count, const std::function<void(size_t, size_t)>& body, size_t alignment = 64);
+	void ParallelChunks(size_t count, const std::function<void(int, size_t, size_t)>& body, size_t alignment = 64);	//same, but body also gets the chunk index in [0, NumThreads()) for indexing per-thread scratch
+
+private:
+	void WorkerLoop(int index);
+	void RunChunk(int index);
+
+	int numThreads = 1;
+	std::vector<std::thread> workers;
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	const std::function<void(int, size_t, size_t)>* job = nullptr;
+	size_t jobCount = 0;
+	size_t jobAlignment = 64;
+	size_t generation = 0;	//bumped for every ParallelFor so workers can tell a new job from a spurious wakeup
+	int pending = 0;
+	bool stop = false;
+};
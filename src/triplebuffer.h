@@ -0,0 +1,26 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+template <typename T>
+class TripleBuffer {	//hands the newest value from one producer thread to one consumer thread without locks, the producer never waits and values the consumer didn't get to in time are overwritten instead of queued
+public:
+	T& Back() { return slots[back]; }	//producer side, the slot to fill next, only ever touched by the producer until Publish
+	void Publish() { back = middle.exchange(back | fresh, std::memory_order_acq_rel) & indexMask; }	//hands Back over and takes whatever slot the consumer isn't looking at as the new one
+
+	bool Update() {	//consumer side, swaps the newest published value into Front, false if nothing was published since the last swap
+		if ((middle.load(std::memory_order_acquire) & fresh) == 0) { return false; }
+		front = middle.exchange(front, std::memory_order_acq_rel) & indexMask;
+		return true;
+	}
+	T& Front() { return slots[front]; }	//consumer side, stays put until the next Update
+
+private:
+	static constexpr uint8_t indexMask = 3;
+	static constexpr uint8_t fresh = 4;	//set in middle while it holds a value the consumer hasn't taken yet
+
+	T slots[3];
+	alignas(64) std::atomic<uint8_t> middle{ 1 };	//the one slot owned by neither side, swapped with whichever side is done with theirs
+	alignas(64) uint8_t back = 0;	//producer's, on its own cache line from the consumer's index
+	alignas(64) uint8_t front = 2;
+};
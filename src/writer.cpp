@@ -0,0 +1,59 @@
+#include "writer.h"
+
+#include <utility>
+
+AsyncWriter::AsyncWriter(size_t maxPending) : maxPending(maxPending), thread([this] { Loop(); }) {}
+
+AsyncWriter::~AsyncWriter() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+	wake.notify_one();
+	thread.join();
+}
+
+void AsyncWriter::Submit(std::function<bool()> write) {
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		room.wait(lock, [this] { return pending.size() < maxPending; });
+		pending.push_back(std::move(write));
+	}
+	wake.notify_one();
+}
+
+bool AsyncWriter::TrySubmit(std::function<bool()> write) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (pending.size() >= maxPending) { return false; }
+		pending.push_back(std::move(write));
+	}
+	wake.notify_one();
+	return true;
+}
+
+bool AsyncWriter::Flush() {
+	std::unique_lock<std::mutex> lock(mutex);
+	room.wait(lock, [this] { return pending.empty() && !busy; });
+	bool ok = !failed;
+	failed = false;
+	return ok;
+}
+
+void AsyncWriter::Loop() {
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		wake.wait(lock, [this] { return !pending.empty() || stop; });
+		if (pending.empty()) { return; }	//only stops once the queue is drained
+		std::function<bool()> write = std::move(pending.front());
+		pending.pop_front();
+		busy = true;
+		room.notify_all();
+		lock.unlock();
+		bool ok = write();
+		lock.lock();
+		busy = false;
+		failed = failed || !ok;
+		room.notify_all();
+	}
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+class AsyncWriter {	//runs file writes on a thread of their own in the order they were submitted, so encoding and disk I/O overlap with the next solve
+public:
+	explicit AsyncWriter(size_t maxPending = 16);	//Submit blocks once this many writes are waiting, so a slow disk can't pile up images in memory without bound
+	~AsyncWriter();	//finishes everything still queued first
+	AsyncWriter(const AsyncWriter&) = delete;
+	AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+	void Submit(std::function<bool()> write);	//write returns false if it failed, after saying why
+	bool TrySubmit(std::function<bool()> write);	//the same without ever waiting, false and write dropped if the queue is full, for callers that mustn't stall
+	bool Flush();	//waits for everything submitted so far, false if any write since the last Flush failed
+
+private:
+	void Loop();
+
+	size_t maxPending;
+	std::mutex mutex;
+	std::condition_variable wake;	//the writer thread waits on this for work
+	std::condition_variable room;	//Submit and Flush wait on this for the queue to go down
+	std::deque<std::function<bool()>> pending;
+	bool busy = false;	//the writer thread is in the middle of one that's already off the queue
+	bool failed = false;
+	bool stop = false;
+	std::thread thread;	//last, so everything it uses exists before it starts
+};